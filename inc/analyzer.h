@@ -0,0 +1,106 @@
+/**
+ * @file analyzer.h
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Interface for the deferred analysis of played audio blocks.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ * 
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "player.h"
+
+/**
+ * @brief How many blocks the queue can hold.
+ * 
+ * Has to be a power of two. Every block takes PLAYER_BUFFER_SIZE halfwords of
+ * RAM.
+ */
+#define ANALYZER_QUEUE_DEPTH (4U)
+
+/**
+ * @brief Available policies what to do with blocks that can't be analyzed in
+ * time.
+ * 
+ * The policy is up to the consumer. Under both a full queue rejects the newest
+ * block, as the producer must not touch the blocks the consumer may still be
+ * reading. Blocks are only ever dropped when the consumer falls behind by
+ * ANALYZER_QUEUE_DEPTH blocks.
+ */
+#define ANALYZER_DROP_NEWEST (0U) //!< every queued block is analyzed fully, in order
+#define ANALYZER_DROP_OLDEST (1U) //!< older queued blocks are only folded in, the newest is analyzed fully
+
+/**
+ * @brief Policy of the queue, one of the ANALYZER_DROP_* values.
+ * 
+ */
+#define ANALYZER_DROP_POLICY (ANALYZER_DROP_OLDEST)
+
+/**
+ * @brief Analyze callback prototype.
+ * 
+ * Gets called by \ref analyzer_loop() with every queued block, in order. The
+ * analysis may keep state over consecutive blocks, e.g. the history of a
+ * filter, so it has to see every block. Only the result of the newest one
+ * is of interest with \ref ANALYZER_DROP_OLDEST.
+ * 
+ * @param[in] samples block with PLAYER_BUFFER_SIZE interleaved stereo samples
+ * @param timestamp timestamp that was given to \ref analyzer_push()
+ * @param latest 1 if the result of the block is needed, 0 if it only has to
+ *               be folded into the state of the analysis
+ */
+typedef void (*analyzer_callback)(int16_t *samples, uint32_t timestamp, int latest);
+
+/**
+ * @brief Initialize the analyzer.
+ * 
+ * @param callback function that analyzes a block
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int analyzer_init(analyzer_callback callback);
+
+/**
+ * @brief Queue a block of audio for analysis.
+ * 
+ * Copies the samples, so the buffer can be reused right away. Only ever call
+ * from one context (producer), e.g. the load data callback of the player.
+ * 
+ * @param[in] samples interleaved stereo samples
+ * @param length count of samples, if less than PLAYER_BUFFER_SIZE the rest of
+ *               the block is filled with silence
+ * @param timestamp passed along to the callback, e.g. the playback position
+ *                  of the block from \ref player_get_load_position()
+ * @retval 0 on success
+ * @retval -1 when the block was dropped as the queue is full
+ */
+int analyzer_push(const int16_t *samples, size_t length, uint32_t timestamp);
+
+/**
+ * @brief Main loop of analyzer module.
+ * 
+ * Passes queued blocks to the callback given to \ref analyzer_init(). With
+ * \ref ANALYZER_DROP_NEWEST that is the oldest block, with
+ * \ref ANALYZER_DROP_OLDEST all of them, the newest one last. Only ever call
+ * from one context (consumer). Should be called when there is spare time, e.g.
+ * when no refill of the player is pending.
+ * 
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int analyzer_loop(void);
+
+/**
+ * @brief Get count of blocks that were not analyzed fully.
+ * 
+ * Counts blocks that were rejected because of a full queue and blocks that
+ * were only folded in by \ref ANALYZER_DROP_OLDEST.
+ * 
+ * @return count of dropped blocks
+ */
+uint32_t analyzer_get_dropped(void);
@@ -0,0 +1,82 @@
+/**
+ * @file decimator.h
+ * @author Reusser Adrian <reusa1@bfh.ch>
+ * @brief Interface for the anti aliasing decimator in front of the dft.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Adrian Reusser
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "dft.h"
+
+/**
+ * @brief Decimation ratio, every n-th output sample of the lowpass is kept.
+ * 
+ * Has to be one or an even number.
+ */
+#define DECIMATOR_RATIO (DFT_UNDER_SAMPLING)
+
+/**
+ * @brief Length of the FIR lowpass in taps.
+ * 
+ * Has to be a power of two between 16 and 128. More taps give a steeper
+ * transition band at the cost of DECIMATOR_TAPS / 2 dual MACs per output.
+ */
+#define DECIMATOR_TAPS (64U)
+
+/**
+ * @brief How many stereo samples (interleaved halfwords) one block has.
+ * 
+ */
+#define DECIMATOR_INPUT_SIZE (DFT_SAMPLE_SIZE)
+
+/**
+ * @brief How many samples of the selected channel one block gets decimated to.
+ * 
+ */
+#define DECIMATOR_OUTPUT_SIZE (DECIMATOR_INPUT_SIZE / (2 * DECIMATOR_RATIO))
+
+/**
+ * @brief How many input samples of the previous block the filter still needs.
+ * 
+ */
+#define DECIMATOR_HISTORY_SIZE (DECIMATOR_TAPS - DECIMATOR_RATIO)
+
+/**
+ * @brief State of a decimator.
+ * 
+ * Holds the input samples of a single channel, the last
+ * DECIMATOR_HISTORY_SIZE of the previous block followed by the current block.
+ * @note The data is read only. Changing values will lead to incorrect function.
+ */
+typedef struct {
+    int16_t samples[DECIMATOR_HISTORY_SIZE + DECIMATOR_INPUT_SIZE / 2] __attribute__((aligned(4)));
+    int channel; // 0 = left, 1 = right
+} decimator_t;
+
+/**
+ * @brief Initialize a decimator.
+ * 
+ * @param[out] decimator decimator to initialize
+ * @param channel channel of the stereo samples to decimate, 0 = left, 1 = right
+ */
+void decimator_init(decimator_t *decimator, int channel);
+
+/**
+ * @brief Lowpass filter and decimate one block of stereo samples.
+ * 
+ * The selected channel is filtered by a windowed sinc FIR lowpass with its
+ * cutoff just below the nyquist frequency of the decimated samples. Only every
+ * DECIMATOR_RATIO-th output is calculated (polyphase), two taps at once with
+ * SIMD instructions.
+ * 
+ * @param decimator decimator with the state of the previous block
+ * @param[in] samples array with stereo samples of length DECIMATOR_INPUT_SIZE
+ * @param[out] decimated array with samples of length DECIMATOR_OUTPUT_SIZE
+ */
+void decimator_process(decimator_t *decimator, const int16_t *samples, int16_t *decimated);
@@ -19,57 +19,200 @@
 /**
  * @brief How many stereo samples the dft function will get.
  * 
- * Depending on \ref DFT_UNDER_SAMPLING all or every n-th sample will be used.
+ * Depending on \ref DFT_UNDER_SAMPLING all samples are used or they are
+ * decimated by the lowpass filter of decimator.h.
  */
 #define DFT_SAMPLE_SIZE (1920U)
 
+/**
+ * @brief Channels that can be analyzed, see \ref DFT_SAMPLE_CHANNEL.
+ * 
+ */
+#define DFT_CHANNEL_LEFT (0U)   //!< left channel only
+#define DFT_CHANNEL_RIGHT (1U)  //!< right channel only
+#define DFT_CHANNEL_STEREO (2U) //!< both channels, only with DFT_BACKEND_FFT
+
 /**
  * @brief Channel to use for the dft.
  * 
- * 0 = left, 1 = right
+ * One of the DFT_CHANNEL_* values. With \ref DFT_CHANNEL_STEREO both channels
+ * are packed into the real and imaginary part of one complex FFT and their
+ * spectra are separated afterwards. This costs little more than a single
+ * transform. Can be given on the command line, e.g. by the host tests.
+ */
+#ifndef DFT_SAMPLE_CHANNEL
+#define DFT_SAMPLE_CHANNEL (DFT_CHANNEL_STEREO)
+#endif
+
+/**
+ * @brief Spectra calculated in stereo mode.
+ * 
+ */
+#define DFT_STEREO_LR (0U) //!< left and right
+#define DFT_STEREO_MS (1U) //!< mid (L + R) / 2 and side (L - R) / 2
+
+/**
+ * @brief Which two spectra the stereo mode calculates.
+ * 
+ * One of the DFT_STEREO_* values.
+ */
+#define DFT_STEREO_MODE (DFT_STEREO_LR)
+
+/**
+ * @brief How many spectra a transform outputs, two in stereo mode.
+ * 
+ * The magnitudes of the second spectrum (right or side) follow directly after
+ * the DFT_MAGNITUDE_SIZE magnitudes of the first spectrum (left or mid).
  */
-#define DFT_SAMPLE_CHANNEL (0U)
+#define DFT_CHANNELS_NUM ((DFT_SAMPLE_CHANNEL == DFT_CHANNEL_STEREO) ? 2 : 1)
 
 /**
  * @brief Determines the undersampling of the given sample input.
  * 
  * For example if this is set to (1U), every sample will be used for the dft.
- * Or if it is set to (4U) every n-th sample of the input samples will be used.
+ * Or if it is set to (4U) the samples are lowpass filtered and decimated to a
+ * quarter of the sample rate. Has to be one or an even number.
  */
 #define DFT_UNDER_SAMPLING (4U)
 
+/**
+ * @brief Length of a single transform.
+ * 
+ * For the FFT, Q15 and CMSIS backends this has to be a power of two between 64
+ * and 1024. Half of it is the count of calculated magnitudes, see
+ * \ref DFT_MAGNITUDE_SIZE. One bin is then (48 kHz / DFT_UNDER_SAMPLING) /
+ * DFT_N wide.
+ */
+#define DFT_N (512U)
+
 /**
  * @brief How many magnitudes should be calculated.
  * 
+ * The magnitudes are the power of the bins, normalized so that they don't
+ * depend on DFT_N and the window. A sine of amplitude A in the center of a bin
+ * has the magnitude (A / 2)^2, a full scale sine about 2^28.
  */
-#define DFT_MAGNITUDE_SIZE (30U)
+#define DFT_MAGNITUDE_SIZE (DFT_N / 2)
 
 /**
- * @brief Enable / disble ASM implementation
+ * @brief Available windows that are applied to the samples of a transform.
  * 
- * ASM implementation is enabled if this macro is defined, comment to disable.
+ * Windowing reduces the spectral leakage of a tone into the neighbouring bins.
+ * The magnitudes are divided by the gain of the window (its first
+ * coefficient), so the level of a tone stays the same.
  */
-#define DFT_USE_ASM (1U)
+#define DFT_WINDOW_RECTANGULAR (0U)     //!< no window
+#define DFT_WINDOW_HANN (1U)            //!< Hann, good all-rounder
+#define DFT_WINDOW_BLACKMAN_HARRIS (2U) //!< 4 term Blackman-Harris, low leakage
+#define DFT_WINDOW_FLAT_TOP (3U)        //!< flat top, accurate amplitudes
 
 /**
- * @brief Calculate the batch size for the algorithm.
+ * @brief Window that is used by all backends.
  * 
- * The given input samples are split up into multiple chunks.
+ * The block based backends multiply the samples with a table while loading
+ * them, \ref DFT_BACKEND_SLIDING applies it to the bins when reading them out.
+ * Anything but DFT_WINDOW_RECTANGULAR needs DFT_N to be a power of two between
+ * 64 and 1024.
  */
-#define DFT_N (DFT_MAGNITUDE_SIZE * 2)
+#define DFT_WINDOW (DFT_WINDOW_HANN)
 
 /**
- * @brief Calculate the batch count for the algorithm.
+ * @brief How many logarithmically spaced bands \ref dft_map_bands() builds.
+ * 
+ * Has to be smaller than DFT_MAGNITUDE_SIZE, every band spans at least one bin.
+ */
+#define DFT_BANDS_NUM (29U)
+
+/**
+ * @brief Range of the band levels of \ref dft_map_bands() in dB.
+ * 
+ * A band with the power of a full scale sine is at the top of the range, one
+ * that is DFT_BANDS_RANGE_DB or more below it at zero.
+ */
+#define DFT_BANDS_RANGE_DB (60U)
+
+/**
+ * @brief Band level of a full scale sine, in steps of 0.1 dB.
+ * 
+ */
+#define DFT_BANDS_FULL_SCALE (10 * DFT_BANDS_RANGE_DB)
+
+/**
+ * @brief Available backends that implement the transform.
+ * 
+ * One of these has to be selected with \ref DFT_BACKEND.
+ */
+#define DFT_BACKEND_C (0U)         //!< direct form dft in C (reference)
+#define DFT_BACKEND_ASM (1U)       //!< direct form dft in assembler
+#define DFT_BACKEND_FFT (2U)       //!< in-place radix-2 FFT in C
+#define DFT_BACKEND_CMSIS_F32 (3U) //!< arm_rfft_fast_f32() of CMSIS-DSP
+#define DFT_BACKEND_CMSIS_Q15 (4U) //!< arm_rfft_q15() of CMSIS-DSP
+#define DFT_BACKEND_Q15 (5U)       //!< direct form dft in fixed point with SIMD
+#define DFT_BACKEND_SLIDING (6U)   //!< incremental sliding dft, O(bins) per sample
+#define DFT_BACKEND_NUM (7U)       //!< count of available backends
+
+/**
+ * @brief Backend that is used by \ref dft_transform().
+ * 
+ * Can be given on the command line, the host tests in test/ check every
+ * backend that builds on the host against a reference dft.
+ */
+#ifndef DFT_BACKEND
+#define DFT_BACKEND (DFT_BACKEND_FFT)
+#endif
+
+/**
+ * @brief Enable / disable benchmark of all backends
  * 
- * How many batches of sample data needs to be processed.
+ * If defined, all backends are compiled in and \ref dft_benchmark() can be
+ * used to compare them. Comment to only compile the selected backend.
+ * @note Benchmarks the mono transforms, so can't be combined with
+ * \ref DFT_CHANNEL_STEREO.
  */
-#define DFT_PARTS_NUM (DFT_SAMPLE_SIZE / (DFT_N * DFT_UNDER_SAMPLING * 2))
+// #define DFT_BENCHMARK (1U)
 
 /**
- * @brief Calculate the length of each sample batch.
+ * @brief Check if a backend is compiled in.
  * 
  */
-#define DFT_PARTS_LENGTH (DFT_SAMPLE_SIZE / DFT_PARTS_NUM)
+#ifdef DFT_BENCHMARK
+#define DFT_BACKEND_ENABLED(backend) (1)
+#else
+#define DFT_BACKEND_ENABLED(backend) (DFT_BACKEND == (backend))
+#endif
+
+/**
+ * @brief How many times every backend is run by \ref dft_benchmark().
+ * 
+ */
+#define DFT_BENCHMARK_RUNS (50U)
+
+/**
+ * @brief Damping of the sliding dft.
+ * 
+ * Every running bin of \ref DFT_BACKEND_SLIDING is multiplied by this factor
+ * per sample. Slightly below one, so that rounding errors of the float state
+ * decay instead of accumulating over a whole song. Older samples of the window
+ * are weighted down by at most DFT_SLIDING_DAMPING^DFT_N.
+ */
+#define DFT_SLIDING_DAMPING (0.99999f)
+
+/**
+ * @brief How many new (undersampled) samples of the selected channel a call to
+ * \ref dft_transform() brings in.
+ * 
+ */
+#define DFT_BLOCK_SIZE (DFT_SAMPLE_SIZE / (2 * DFT_UNDER_SAMPLING))
+
+/**
+ * @brief Calculate the batch count for the algorithm.
+ * 
+ * If a block holds enough samples for multiple transforms, it is split up into
+ * multiple batches and their magnitudes are averaged. Otherwise a single
+ * transform is done over the last DFT_N samples of the current and previous
+ * blocks.
+ */
+#define DFT_PARTS_NUM ((DFT_BLOCK_SIZE >= DFT_N) ? (DFT_BLOCK_SIZE / DFT_N) : 1)
 
 /**
  * @brief Index offset into \ref g_twiddle_factors for sinus.
@@ -83,6 +226,9 @@
 /**
  * @brief Calculates the initial twiddle factors for dft algorithm.
  * 
+ * Also initializes the decimator, the bin to band table of \ref dft_map_bands() and the
+ * CMSIS-DSP instances if those backends are used.
+ * 
  * @note Has to be called once before \ref dft_transform() can be used.
  */
 void dft_init(void);
@@ -91,12 +237,76 @@ void dft_init(void);
  * @brief Calculate the dft magnitudes of the given samples.
  * 
  * The inner workings can be modified with the precompiler parameters
- * \ref DFT_SAMPLE_SIZE, \ref DFT_UNDER_SAMPLING and \ref DFT_MAGNITUDE_SIZE.
+ * \ref DFT_SAMPLE_SIZE, \ref DFT_UNDER_SAMPLING and \ref DFT_N.
  * @note Before using this function, \ref dft_init() should be called once.
  * 
  * @param[in] samples arrary with samples of length DFT_SAMPLE_SIZE
- * @param[out] magnitude array with magnitudes DFT_MAGNITUDE_SIZE in length
+ * @param[out] magnitude array with magnitudes DFT_CHANNELS_NUM *
+ *                       DFT_MAGNITUDE_SIZE in length
  */
 void dft_transform(int16_t *samples, uint32_t *magnitude);
 
+/**
+ * @brief Fold a new block of samples into the analyzer state.
+ * 
+ * First half of \ref dft_transform(). With \ref DFT_BACKEND_SLIDING every new
+ * sample updates all bins, so the cost is constant per block and the spectrum
+ * is always up to date. The other backends only store the samples and do the
+ * actual transform in \ref dft_get_magnitude().
+ * @note Before using this function, \ref dft_init() should be called once.
+ * 
+ * @param[in] samples arrary with samples of length DFT_SAMPLE_SIZE
+ */
+void dft_update(int16_t *samples);
+
+/**
+ * @brief Get the dft magnitudes of the samples given so far.
+ * 
+ * Second half of \ref dft_transform(). Can be called at any time and as often
+ * as needed. With \ref DFT_BACKEND_SLIDING this only reads out the running
+ * bins.
+ * 
+ * @param[out] magnitude array with magnitudes DFT_CHANNELS_NUM *
+ *                       DFT_MAGNITUDE_SIZE in length
+ */
+void dft_get_magnitude(uint32_t *magnitude);
+
+/**
+ * @brief Sum the magnitudes up into logarithmically spaced bands.
+ * 
+ * The bins 1 up to DFT_MAGNITUDE_SIZE - 1 (DC is left out) are split into
+ * \ref DFT_BANDS_NUM bands of constant relative width, like an octave analyzer.
+ * Where a band would be narrower than a bin, it gets a single bin. The bin to
+ * band table is calculated by \ref dft_init(). In stereo mode the power of both
+ * spectra is averaged. The power of every band is converted to a level in dB,
+ * so that quiet and loud bands both stay visible.
+ * 
+ * @param[in] magnitude array with magnitudes DFT_CHANNELS_NUM *
+ *                      DFT_MAGNITUDE_SIZE in length
+ * @param[out] bands array with band levels DFT_BANDS_NUM in length, 0 up to
+ *                   \ref DFT_BANDS_FULL_SCALE in steps of 0.1 dB
+ */
+void dft_map_bands(const uint32_t *magnitude, uint32_t *bands);
+
+#ifdef DFT_BENCHMARK
+
+/**
+ * @brief Measure the cycles per \ref dft_transform() of every backend.
+ * 
+ * Every backend is run \ref DFT_BENCHMARK_RUNS times on the same synthetic
+ * block of samples. The average cycle count is printed per backend with
+ * printf() and returned in \par cycles. So that the backends can be checked on
+ * the target, the largest deviation of their last magnitudes from those of
+ * \ref DFT_BACKEND_C on the same samples is printed too, in ppm of the peak.
+ * Q15 should stay below about 2000 ppm and the sliding dft below 20000 ppm,
+ * the floating point backends below 100 ppm.
+ * @note Before using this function, \ref dft_init() and \ref utils_init()
+ * should be called once.
+ * 
+ * @param[out] cycles average cycles per call, indexed by DFT_BACKEND_*
+ */
+void dft_benchmark(uint32_t cycles[DFT_BACKEND_NUM]);
+
+#endif // DFT_BENCHMARK
+
 #endif // ASM_SOURCE
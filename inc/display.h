@@ -30,6 +30,48 @@
  */
 #define DISPLAY_NUM_OF_SPECTOGRAM_BARS (29U)
 
+/**
+ * @brief How many spectogram data sets can wait for their time to be shown.
+ * 
+ * See \ref display_queue_spectogram(). If more are queued the oldest gets
+ * dropped. Has to cover how many blocks ahead of playback the audio gets
+ * analyzed, which is up to PLAYER_BUFFER_NUM + 1.
+ */
+#define DISPLAY_SPECTOGRAM_QUEUE_DEPTH (8U)
+
+/**
+ * @brief How many songs of the list are shown at once.
+ * 
+ * The list is browsed page by page, only the shown page is held in RAM. With
+ * the normal font of 13 pixels height 18 lines fit on the 240 pixels of the
+ * LCD.
+ */
+#define DISPLAY_LIST_PAGE_SIZE (18U)
+
+/**
+ * @brief List callback prototype.
+ * 
+ * Gets called by \ref display_loop() whenever the selection moved to another
+ * page of the list. Has the same signature as \ref songs_list_songs().
+ * 
+ * @param first position of the first song of the page in the list
+ * @param[out] songs array of DISPLAY_LIST_PAGE_SIZE songs to fill
+ * @param[in,out] length in: size of the array, out: count of filled songs
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+typedef int (*display_list_callback)(size_t first, song_info_t songs[], size_t *length);
+
+/**
+ * @brief Clock callback prototype.
+ * 
+ * Gets called by \ref display_loop() at every refresh of the LCD to decide
+ * which of the queued spectograms should be shown.
+ * 
+ * @return current time in the unit of the queued timestamps
+ */
+typedef uint32_t (*display_clock_callback)(void);
+
 /**
  * @brief Initialise display driver and lower hardware.
  * 
@@ -51,39 +93,59 @@ int display_loop(void);
 /**
  * @brief Set the display into mode "List" and display a list of songs.
  * 
- * @param songs array of songs with valid infos, will be printed on screen
+ * The songs are loaded page by page with \par list while the selection moves
+ * through the list. Reads are done while holding back the refill of the
+ * player, see \ref player_lock().
+ * 
  * @param length how many songs there are in the list
+ * @param list function that loads a page of the list
  * @retval 0 on success
  * @retval -1 on failure
  */
-int display_set_list(const song_t songs[], size_t length);
+int display_set_list(size_t length, display_list_callback list);
 
 /**
  * @brief Change the currently selected song in the list.
  * 
  * The currently selected song will be printed with inverted text colors (white
  * background, black letters). With this function the selection can be moved up
- * or down step by step. This is intended for navigation buttons.
+ * or down step by step. This is intended for navigation buttons. Moving past
+ * the first or last song of a page shows the next page of the list.
  * 
  * @note Only call in mode "List" e.g. after \ref display_set_list() was called.
  * 
  * @param direction 0 = move down in the list, 1 = move up in the list
  * @retval 0 on success
- * @retval -1 on failure (wrong mode)
+ * @retval -1 on failure (wrong mode or empty list)
  */
 int display_move_selection(int direction);
 
+/**
+ * @brief Select a song of the list by its position.
+ * 
+ * Like \ref display_move_selection(), but jumps straight to the position, e.g.
+ * to the first song of an artist. Shows the page of the song if it is on
+ * another one.
+ * 
+ * @note Only call in mode "List" e.g. after \ref display_set_list() was called.
+ * 
+ * @param position position of the song in the list
+ * @retval 0 on success
+ * @retval -1 on failure (wrong mode or position past the end of the list)
+ */
+int display_set_selection(size_t position);
+
 /**
  * @brief Get the currently selected song in the list.
  * 
  * @note Only call in mode "List" e.g. after \ref display_set_list() was called.
  * 
- * @param[out] song will be set to a pointer to the currently selected song in
- *                  the initially given list with \ref display_set_list()
+ * @param[out] song will be set to the infos of the currently selected song
+ * @param[out] position will be set to the position of the song in the list
  * @retval 0 on success
- * @retval -1 on failure (wrong mode)
+ * @retval -1 on failure (wrong mode or empty list)
  */
-int display_get_selection(song_t **song);
+int display_get_selection(song_info_t *song, size_t *position);
 
 /**
  * @brief Set the display into mode "Song" and display song informations.
@@ -107,3 +169,30 @@ int display_set_song(const song_t *song);
  * @retval -1 on failure (wrong mode)
  */
 int display_set_spectogram(uint32_t spectogram[DISPLAY_NUM_OF_SPECTOGRAM_BARS], uint32_t max_value);
+
+/**
+ * @brief Queue spectogram data that should be displayed at a given time.
+ * 
+ * At each refresh of the LCD the newest queued data whose timestamp is due is
+ * displayed, older data is dropped. Intended to show the spectogram of the
+ * audio that is heard right now and not of the audio that was just analyzed.
+ * 
+ * @note Without a clock set by \ref display_set_clock() the data is shown
+ * right away like with \ref display_set_spectogram().
+ * 
+ * @param spectogram array of spectogram data in the range 0 to \par max_value
+ * @param max_value upper limit of data, see \ref display_set_spectogram()
+ * @param timestamp time from when on the data should be displayed
+ * @retval 0 on success
+ * @retval -1 on failure (wrong mode)
+ */
+int display_queue_spectogram(uint32_t spectogram[DISPLAY_NUM_OF_SPECTOGRAM_BARS], uint32_t max_value, uint32_t timestamp);
+
+/**
+ * @brief Set the clock for the timestamps of queued spectograms.
+ * 
+ * @param clock function that returns the current time
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int display_set_clock(display_clock_callback clock);
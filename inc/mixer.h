@@ -0,0 +1,41 @@
+/**
+ * @file mixer.h
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Interface for the crossfade of two songs.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ * 
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief How many steps the gain curve has over the whole crossfade.
+ * 
+ * The gain between two steps is interpolated linearly.
+ */
+#define MIXER_GAIN_STEPS (256U)
+
+/**
+ * @brief Crossfade two blocks of stereo samples with equal power.
+ * 
+ * The outgoing samples are scaled by a cosine and the incoming ones by a sine
+ * quarter period over the duration of the crossfade. The sum of both powers
+ * stays constant, so uncorrelated songs keep their loudness. Both are added
+ * with saturation, two samples at once with SIMD instructions.
+ * 
+ * @param[in] outgoing interleaved stereo samples of the song that fades out
+ * @param[in] incoming interleaved stereo samples of the song that fades in
+ * @param[out] mixed interleaved stereo samples, may be one of the inputs
+ * @param length count of samples (halfwords) in each block, has to be even
+ * @param position samples of the crossfade that were mixed before this block
+ * @param duration samples the whole crossfade takes, not 0
+ * @note All blocks have to be word aligned.
+ */
+void mixer_crossfade(const int16_t *outgoing, const int16_t *incoming, int16_t *mixed, size_t length,
+                     uint32_t position, uint32_t duration);
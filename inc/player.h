@@ -24,18 +24,47 @@
  */
 #define PLAYER_BUFFER_SIZE (1920U)
 
+/**
+ * @brief Count of buffers in the refill ring.
+ * 
+ * Each buffer holds PLAYER_BUFFER_SIZE halfwords. The DMA plays them one after
+ * the other, so the main loop may be late with a refill by about
+ * (PLAYER_BUFFER_NUM - 1) * 20 ms before an underrun happens. Has to be at
+ * least two.
+ */
+#define PLAYER_BUFFER_NUM (4U)
+
+/**
+ * @brief Refill the ring from an interrupt instead of the main loop.
+ * 
+ * If defined, the DMA interrupt pends the lowest priority interrupt (PendSV)
+ * which then calls \ref player_load_data_callback. A refill can then only be
+ * delayed by other interrupts and by \ref player_lock(), but not by slow work
+ * of the main loop. Otherwise the refill is done in \ref player_loop().
+ */
+#define PLAYER_REFILL_IN_ISR
+
+/**
+ * @brief How many of the last glitches are kept, see \ref player_get_glitches().
+ * 
+ */
+#define PLAYER_GLITCH_LOG_SIZE (8U)
+
 /**
  * @brief Load data callback prototype.
  * 
  * When the player is playing audio i.e. \ref player_play was called, then the
  * player calls this callback to load the first PLAYER_BUFFER_SIZE halfwords of
- * the bitstream that should be played. While that data is being transfered over
- * DMA to the audio codec, the callback is called again to load the next data.
- * After the first part is finished playing the second part will be transfered
- * with DMA. Then a third part is requested with this callback. This goes on
- * until the callback gives a length of less than \ref PLAYER_BUFFER_SIZE back.
- * When that happens, no more data will be requested, instead the player will
- * pause.
+ * the bitstream that should be played. The callback is called again until all
+ * PLAYER_BUFFER_NUM buffers of the ring are loaded. While those are transfered
+ * one after the other over DMA to the audio codec, every buffer that finished
+ * playing is requested again with this callback. This goes on until the
+ * callback gives a length of less than \ref PLAYER_BUFFER_SIZE back. When that
+ * happens, no more data will be requested, instead the player will pause.
+ * 
+ * @note With PLAYER_REFILL_IN_ISR this is called from an interrupt. Anything
+ * that it shares with the main loop, e.g. the file system, may only be used by
+ * the main loop while holding \ref player_lock().
  * 
  * The PCM bitstream should have:
  *  - a samplerate of 48000 Hz
@@ -49,6 +78,39 @@
  */
 typedef int (*player_load_data_callback)(int16_t *data, size_t *length);
 
+/**
+ * @brief Statistics of the refill ring.
+ * 
+ * Except depth and fill, all values are of the current session e.g. since the
+ * last call of \ref player_play().
+ */
+typedef struct {
+    uint32_t depth;        //!< count of buffers in the ring, PLAYER_BUFFER_NUM
+    uint32_t fill;         //!< count of loaded buffers that were not yet played
+    uint32_t refills;      //!< count of loaded buffers
+    uint32_t underruns;    //!< count of buffers that were replaced by silence
+    uint32_t missed_irqs;  //!< count of buffers that were sent twice, the DMA interrupt was too late
+    uint32_t min_slack_us; //!< least audio in microseconds that was still queued when a refill started, UINT32_MAX if none yet
+} player_stats_t;
+
+/**
+ * @brief Types of glitches.
+ * 
+ */
+typedef enum {
+    PLAYER_GLITCH_UNDERRUN = 0, //!< refill too late, the ring was empty and silence was sent
+    PLAYER_GLITCH_MISSED_IRQ    //!< DMA interrupt too late, a stale buffer was sent again
+} player_glitch_type_t;
+
+/**
+ * @brief Record of a glitch.
+ * 
+ */
+typedef struct {
+    player_glitch_type_t type; //!< what happened
+    uint32_t position;         //!< playback position, see \ref player_get_position()
+} player_glitch_t;
+
 /**
  * @brief Initialize audio hardware.
  * 
@@ -65,13 +127,94 @@ int player_init(player_load_data_callback callback);
  * 
  * Needs to be called periodically, at least once for every: size of audiofile
  * in halfwords divided by PLAYER_BUFFER_SIZE. Will return as fast as possible
- * if nothing has to be done.
+ * if nothing has to be done. With PLAYER_REFILL_IN_ISR it has nothing to do
+ * but is kept for compatibility.
  * 
  * @retval 0 on success
  * @retval -1 on failure
  */
 int player_loop(void);
 
+/**
+ * @brief Check if a buffer of the ring waits to be reloaded.
+ * 
+ * Work that is not time critical should be postponed while this is the case,
+ * so that \ref player_loop() can refill the buffer before the DMA needs it.
+ * With PLAYER_REFILL_IN_ISR this is only the case for a short time or while
+ * \ref player_lock() is held.
+ * 
+ * @retval 1 if a refill is pending
+ * @retval 0 otherwise
+ */
+int player_is_refill_pending(void);
+
+/**
+ * @brief Get the current playback position.
+ * 
+ * Counts the halfwords that were sent to the codec since initialization, from
+ * the transfer counter of the DMA stream and the count of completed buffer
+ * cycles. The counter keeps running while stopped (silence is sent) and wraps
+ * around after about 12 hours, so only compare positions by their difference.
+ * 
+ * @return playback position in halfwords
+ */
+uint32_t player_get_position(void);
+
+/**
+ * @brief Get the playback position of the data that is being loaded.
+ * 
+ * Only valid while in \ref player_load_data_callback. Tells at which position
+ * (see \ref player_get_position()) the first halfword of the requested data
+ * will be sent to the codec.
+ * 
+ * @return playback position in halfwords
+ */
+uint32_t player_get_load_position(void);
+
+/**
+ * @brief Get statistics of the refill ring.
+ * 
+ * An underrun is counted when the DMA needs the next buffer while playing but
+ * the ring is empty, e.g. the refill was too late. The slack of a refill is how
+ * much audio was still queued for the DMA when it started, the minimum shows
+ * how close the player got to an underrun.
+ * 
+ * @param[out] stats current fill level and counters of this session
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int player_get_stats(player_stats_t *stats);
+
+/**
+ * @brief Get the last glitches.
+ * 
+ * Glitches are logged over all sessions, only the last PLAYER_GLITCH_LOG_SIZE
+ * are kept.
+ * 
+ * @param[out] glitches array that gets the glitches, oldest first
+ * @param[out] count count of valid glitches in the array
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int player_get_glitches(player_glitch_t glitches[PLAYER_GLITCH_LOG_SIZE], size_t *count);
+
+/**
+ * @brief Hold back refills of the player.
+ * 
+ * Used by the main loop to get exclusive access to what the load data callback
+ * uses, e.g. the file system. A refill that gets due in the meantime is done
+ * in \ref player_unlock(). Can be nested, but keep the locked time shorter
+ * than the audio in the ring.
+ */
+void player_lock(void);
+
+/**
+ * @brief Allow refills of the player again.
+ * 
+ * Has to be called once for every call of \ref player_lock().
+ */
+void player_unlock(void);
+
 /**
  * @brief Start playing audio.
  * 
@@ -0,0 +1,110 @@
+/**
+ * @file resampler.h
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Interface for the sample rate conversion of songs to 48 kHz.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ * 
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Sample rate of the output, the one of the player.
+ * 
+ */
+#define RESAMPLER_OUTPUT_RATE (48000U)
+
+/**
+ * @brief Length of every phase of the polyphase lowpass in taps.
+ * 
+ * Has to be 16 or 32. More taps give a steeper transition band at the cost of
+ * RESAMPLER_TAPS / 2 dual MACs per output sample. With 32 taps one 20 ms block
+ * of the player takes about 110000 cycles (0.65 ms at 168 MHz, 3 % of the
+ * block), 1920 outputs with 16 SMLAD and their loads each. The tables take
+ * (160 + 3) * RESAMPLER_TAPS halfwords of flash.
+ */
+#define RESAMPLER_TAPS (32U)
+
+/**
+ * @brief How many stereo samples (frames) can be written at once.
+ * 
+ */
+#define RESAMPLER_INPUT_SIZE (512U)
+
+/**
+ * @brief State of a resampler.
+ * 
+ * Holds the input samples of both channels, each once as written and once
+ * shifted by one sample. The window of every output then starts word aligned
+ * in one of them, and two samples can be multiplied with two taps at once.
+ * @note The data is read only. Changing values will lead to incorrect function.
+ */
+typedef struct {
+    const int16_t *taps; // RESAMPLER_TAPS taps of every phase
+    uint32_t up;         // count of phases between two input samples
+    uint32_t down;       // phases between two output samples
+    uint32_t phase;      // phase of the next output
+    uint32_t count;      // input samples of every channel
+    uint32_t index;      // first input sample of the next output window
+    int16_t samples[2][2][RESAMPLER_TAPS + RESAMPLER_INPUT_SIZE] __attribute__((aligned(4)));
+} resampler_t;
+
+/**
+ * @brief Check if a sample rate can be converted.
+ * 
+ * @param rate sample rate of the input
+ * @retval 1 if the sample rate is supported
+ * @retval 0 if not
+ */
+int resampler_supports(uint32_t rate);
+
+/**
+ * @brief Initialize a resampler.
+ * 
+ * Supported are 44100 Hz and 32000 Hz. The output is delayed by half the
+ * length of a phase, about 0.4 ms at 44.1 kHz.
+ * 
+ * @param[out] resampler resampler to initialize
+ * @param rate sample rate of the input
+ * @retval 0 on success
+ * @retval -1 if the sample rate is not supported
+ */
+int resampler_init(resampler_t *resampler, uint32_t rate);
+
+/**
+ * @brief Get how many input samples can be written.
+ * 
+ * @param resampler initialized resampler
+ * @return count of interleaved stereo samples (halfwords)
+ */
+size_t resampler_space(resampler_t *resampler);
+
+/**
+ * @brief Write input samples.
+ * 
+ * @param resampler initialized resampler
+ * @param[in] samples interleaved stereo samples, NULL for silence
+ * @param length count of samples (halfwords), has to be even
+ * @return count of samples that were written, less if there was no space
+ */
+size_t resampler_write(resampler_t *resampler, const int16_t *samples, size_t length);
+
+/**
+ * @brief Read output samples at 48 kHz.
+ * 
+ * Every output is the polyphase FIR lowpass over the input around its point
+ * in time. The taps are generated at compile time in Q15 and applied two at
+ * once with SIMD instructions.
+ * 
+ * @param resampler initialized resampler
+ * @param[out] samples interleaved stereo samples
+ * @param length count of samples (halfwords) to read, has to be even
+ * @return count of samples that were read, less if more input is needed
+ */
+size_t resampler_read(resampler_t *resampler, int16_t *samples, size_t length);
@@ -0,0 +1,115 @@
+/**
+ * @file simd.h
+ * @author Reusser Adrian <reusa1@bfh.ch>
+ * @brief SIMD intrinsics of the Cortex-M4 DSP extension.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Adrian Reusser
+ * 
+ * On the target the intrinsics of CMSIS (core_cmSimd.h) are used. On any other
+ * platform e.g. a host build for verification, the same intrinsics are
+ * emulated in plain C so that fixed point code gives identical results.
+ * @note On a host build include this before any CMSIS header, the emulation
+ * then takes the place of core_cmSimd.h.
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP)
+
+#include <stm32f4xx.h>
+
+#elif !defined(__CORE_CMSIMD_H) // C emulation
+#define __CORE_CMSIMD_H
+
+/**
+ * @brief Dual 16-bit signed multiply with single 64-bit accumulator.
+ * 
+ * acc + op1[15:0] * op2[15:0] + op1[31:16] * op2[31:16]
+ * 
+ * @param op1 two packed signed halfwords
+ * @param op2 two packed signed halfwords
+ * @param acc 64-bit accumulator
+ * @return new accumulator value
+ */
+static inline uint64_t __SMLALD(uint32_t op1, uint32_t op2, uint64_t acc) {
+    int64_t lo = (int32_t)(int16_t)op1 * (int32_t)(int16_t)op2;
+    int64_t hi = (int32_t)(int16_t)(op1 >> 16) * (int32_t)(int16_t)(op2 >> 16);
+    return (uint64_t)((int64_t)acc + lo + hi);
+}
+
+/**
+ * @brief Dual 16-bit signed multiply with 32-bit accumulator.
+ * 
+ * acc + op1[15:0] * op2[15:0] + op1[31:16] * op2[31:16]
+ * 
+ * @param op1 two packed signed halfwords
+ * @param op2 two packed signed halfwords
+ * @param acc 32-bit accumulator
+ * @return new accumulator value
+ */
+static inline uint32_t __SMLAD(uint32_t op1, uint32_t op2, uint32_t acc) {
+    int32_t lo = (int32_t)(int16_t)op1 * (int32_t)(int16_t)op2;
+    int32_t hi = (int32_t)(int16_t)(op1 >> 16) * (int32_t)(int16_t)(op2 >> 16);
+    return acc + (uint32_t)lo + (uint32_t)hi;
+}
+
+/**
+ * @brief Dual 16-bit signed saturating addition.
+ * 
+ * op1[15:0] + op2[15:0] and op1[31:16] + op2[31:16], each saturated to the
+ * range of a signed halfword.
+ * 
+ * @param op1 two packed signed halfwords
+ * @param op2 two packed signed halfwords
+ * @return two packed signed halfwords
+ */
+static inline uint32_t __QADD16(uint32_t op1, uint32_t op2) {
+    int32_t lo = (int32_t)(int16_t)op1 + (int32_t)(int16_t)op2;
+    int32_t hi = (int32_t)(int16_t)(op1 >> 16) + (int32_t)(int16_t)(op2 >> 16);
+    lo = (lo > INT16_MAX) ? INT16_MAX : (lo < INT16_MIN) ? INT16_MIN : lo;
+    hi = (hi > INT16_MAX) ? INT16_MAX : (hi < INT16_MIN) ? INT16_MIN : hi;
+    return ((uint32_t)hi << 16) | ((uint32_t)lo & 0x0000FFFFUL);
+}
+
+/**
+ * @brief Pack halfword, bottom of ARG1 and top of ARG2 shifted left by ARG3.
+ * 
+ */
+#define __PKHBT(ARG1, ARG2, ARG3) ((((uint32_t)(ARG1)) & 0x0000FFFFUL) | \
+                                   ((((uint32_t)(ARG2)) << (ARG3)) & 0xFFFF0000UL))
+
+#endif // __ARM_FEATURE_DSP
+
+/**
+ * @brief Load two consecutive Q15 values as packed halfwords.
+ * 
+ * Goes through memcpy() like read_q15x2() of CMSIS-DSP, as an int16_t array
+ * must not be read through a uint32_t pointer (strict aliasing). The compiler
+ * turns it into a single word load.
+ * 
+ * @param[in] p first of the two values, the lower halfword
+ * @return two packed signed halfwords
+ */
+static inline uint32_t read_q15x2(const int16_t *p) {
+    uint32_t pair;
+    memcpy(&pair, p, sizeof(pair));
+    return pair;
+}
+
+/**
+ * @brief Store packed halfwords as two consecutive Q15 values.
+ * 
+ * Counterpart of \ref read_q15x2(), a single word store.
+ * 
+ * @param[out] p first of the two values, gets the lower halfword
+ * @param pair two packed signed halfwords
+ */
+static inline void write_q15x2(int16_t *p, uint32_t pair) {
+    memcpy(p, &pair, sizeof(pair));
+}
@@ -16,7 +16,7 @@
 #include <ff.h>
 
 /**
- * @brief Maximum length for artist and name strings in \ref song_t structure.
+ * @brief Maximum length for artist and name strings in \ref song_info_t structure.
  * 
  */
 #define SONGS_MAX_STRING_LENGTH (30U)
@@ -32,22 +32,120 @@
 #define SONGS_MAX_FATFS_FILE_NAME_LENGTH (sizeof(((FILINFO *)0)->fname))
 
 /**
- * @brief Song file object.
+ * @brief How many levels of folders below the root folder are searched.
+ * 
+ * E.g. 2 for songs sorted into "ARTIST/ALBUM/". Every level keeps one opened
+ * FatFS directory object while the folders are searched. Deeper folders are
+ * ignored.
+ */
+#define SONGS_MAX_FOLDER_DEPTH (4U)
+
+/**
+ * @brief Maximum length of the path of a song or album cover.
+ * 
+ * Paths are built from the 8.3 names of the folders and the file, e.g.
+ * "ARTIST/ALBUM/SONG.WAV", so a path of the deepest level always fits.
+ */
+#define SONGS_MAX_PATH_LENGTH ((SONGS_MAX_FOLDER_DEPTH + 1) * SONGS_MAX_FATFS_FILE_NAME_LENGTH)
+
+/**
+ * @brief How many blocks the read ahead of the opened songs can hold.
+ * 
+ * At least two. The blocks are topped up in the background whenever one was
+ * consumed, so this many blocks of upcoming pcm data cover for slow reads of
+ * the SD-Card. While two songs are read at once, each gets half of them.
+ */
+#define SONGS_PREFETCH_DEPTH (4U)
+
+/**
+ * @brief How many sectors one block of the read ahead ring holds.
+ * 
+ * Every block takes this many sectors of RAM and is read with one multi block
+ * transfer. Should hold at least one player buffer.
+ */
+#define SONGS_PREFETCH_BLOCK_SECTORS (8U)
+
+/**
+ * @brief Size of the cluster link map of an opened song in DWORDs.
+ * 
+ * Every fragment of the file takes two entries, two more are needed for the
+ * header. So 32 entries cover 15 fragments of any length, a file that was
+ * written in one go usually has one. In the worst case, with every cluster
+ * somewhere else, that are only 15 clusters. Songs with more fragments are
+ * read without read ahead. Building the map reads the FAT entry of every
+ * cluster of the file, e.g. 1280 for a song of 40 MiB with clusters of
+ * 32 KiB, see \ref songs_open_song().
+ */
+#define SONGS_PREFETCH_MAP_SIZE (32U)
+
+/**
+ * @brief Name of the library index in the root folder of the SD-Card.
+ * 
+ * Caches the parsed headers of all songs, keyed by name, size and timestamp of
+ * their .WAV file. At boot only new or changed files are parsed, the index is
+ * rewritten if anything changed. Delete it to parse all songs again.
+ */
+#define SONGS_INDEX_FILE_NAME "SONGS.IDX"
+
+/**
+ * @brief Name of the sorted library in the root folder of the SD-Card.
+ * 
+ * Copy of the library index with the songs sorted by artist, then by title.
+ * It is sorted again only when the index was rewritten. Delete it to sort the
+ * songs again.
+ */
+#define SONGS_SORTED_FILE_NAME "SONGS.SRT"
+
+/**
+ * @brief Meta info of a song.
  * 
- * Holds the necessary FatFS filepointer and meta info of artist and song name
- * as well as stats about the already read length.
+ * Everything that is known of a song without opening it, e.g. an entry of the
+ * library listed with \ref songs_list_songs(). Holds no FatFS file object, so
+ * a page of the library takes little RAM.
  * @note The data is read only. Changing values will lead to incorrect function.
  */
 typedef struct {
-    FIL file;
-    char filename[SONGS_MAX_FATFS_FILE_NAME_LENGTH];
+    char filename[SONGS_MAX_PATH_LENGTH]; // path of the .WAV file
     char name[SONGS_MAX_STRING_LENGTH];
     char artist[SONGS_MAX_STRING_LENGTH];
-    char bmp_name[SONGS_MAX_FATFS_FILE_NAME_LENGTH]; // name of BMP file of album cover
-    size_t samples;                                  // num of samples of the full song
-    size_t samples_read;                             // num samples already read
+    char bmp_name[SONGS_MAX_PATH_LENGTH]; // path of BMP file of album cover
+    size_t samples;                       // num of samples of the full song at 48 kHz
+    uint32_t sample_rate;                 // sample rate of the pcm data in the file
+    size_t data_offset;                   // file offset of the pcm data
+    size_t data_size;                     // size of the pcm data in bytes
+    uint32_t file_size;                   // size of the .WAV file, key of the library index
+    uint32_t file_time;                   // FAT date and time of the .WAV file, same
+} song_info_t;
+
+/**
+ * @brief Song file object.
+ * 
+ * Holds the necessary FatFS filepointer and meta info of an opened song as
+ * well as stats about the already read length. Only the songs that are played
+ * need one.
+ * @note The data is read only. Changing values will lead to incorrect function.
+ */
+typedef struct {
+    FIL file;
+    song_info_t info;
+    size_t samples_read;                // num samples already read at 48 kHz
+    DWORD map[SONGS_PREFETCH_MAP_SIZE]; // cluster link map of the file, used if it fits
 } song_t;
 
+/**
+ * @brief Statistics of the read ahead.
+ * 
+ * Except depth, fill and headroom, all values are since the song was opened.
+ */
+typedef struct {
+    uint32_t depth;      //!< count of blocks of the read ahead, SONGS_PREFETCH_DEPTH
+    uint32_t fill;       //!< count of blocks that were read ahead and not yet consumed
+    uint32_t hits;       //!< count of reads that were served from RAM
+    uint32_t misses;     //!< count of reads that ran out of read ahead data and were filled up with silence
+    uint32_t throughput; //!< bytes per second the SD-Card delivered while reading, 0 if nothing was read yet
+    uint32_t headroom;   //!< throughput in percent of what the songs that are read need, 0 if none
+} songs_prefetch_stats_t;
+
 /**
  * @brief Initialize filesystem.
  * 
@@ -57,36 +155,101 @@ typedef struct {
 int songs_init(void);
 
 /**
- * @brief Retrieve a list (array) of all songs on the SD-Card.
+ * @brief Search the SD-Card for songs and update the library.
+ * 
+ * This searches the root folder of the SD-Card and its subfolders up to
+ * \ref SONGS_MAX_FOLDER_DEPTH for .wav files and checks their validity. Files
+ * that did not change since the last scan are taken from the library index
+ * \ref SONGS_INDEX_FILE_NAME without parsing them again. The index is
+ * rewritten if anything changed. Only one song and one opened folder per
+ * level are held in RAM at a time, the library can have any size.
  * 
- * This searches the root folder of the SD-Card for .wav files, checks their
- * validity and returns the filled array.
+ * The library is then sorted by artist and title into
+ * \ref SONGS_SORTED_FILE_NAME, unless it was sorted already. The sort merges
+ * runs of records on the SD-Card, a few records at a time.
  * 
- * @param[in,out] songs in: an array of song_t structures
- *                      out: the first "length"-count elements of the array are
- *                      filled with song information.
- * @param[in,out] length in: how many elements in the array of song_t's are
- *                       out: how many valid songs were found
+ * @param[out] length how many valid songs were found
  * @retval 0 on success
  * @retval -1 on failure
  */
-int songs_list_songs(song_t songs[], size_t *length);
+int songs_scan_songs(size_t *length);
+
+/**
+ * @brief Retrieve a page of the library.
+ * 
+ * The songs are sorted by artist, then by title, both without regard to
+ * their case. A page is read from the sorted library. If it could not be
+ * written, e.g. on a write protected SD-Card, the songs are in the order of
+ * their folders and are parsed on the way. Then a page that follows the last
+ * one goes on where that stopped, only a page before it parses the songs in
+ * front of it again.
+ * 
+ * @param first position of the first song of the page in the library
+ * @param[out] songs the first "length"-count elements of the array are filled
+ *                   with song information
+ * @param[in,out] length in: how many elements in the array of song_info_t's
+ *                       are
+ *                       out: how many songs were listed, less at the end of
+ *                       the library
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int songs_list_songs(size_t first, song_info_t songs[], size_t *length);
+
+/**
+ * @brief Find the first song of an artist in the sorted library.
+ * 
+ * Binary search over the sorted library, takes about log2(n) reads of single
+ * records. Artists are compared without regard to their case.
+ * 
+ * @param prefix start of the name of the artist, e.g. "b" for the first song
+ *               of all artists starting with b
+ * @param[out] position position of the first song whose artist starts with
+ *                      the prefix or follows it, the count of songs if all
+ *                      artists come before it
+ * @retval 0 on success
+ * @retval -1 on failure (e.g. the library is not sorted)
+ */
+int songs_find_song(const char *prefix, size_t *position);
 
 /**
  * @brief Open song by name.
  * 
- * @note \par name has to comply to the fat file naming rules (8.3) e.g.
- * "test_abcd.wav" is accessed as "TEST_A~1.WAV".
- * @note The WAV file is validated for correct sample frequency of 48 kHz and
- * correct pcm format. Non conforming files will not be opened.
+ * Parses the headers and builds the cluster link map of the file, see
+ * \ref SONGS_PREFETCH_MAP_SIZE. That takes a few reads of the SD-Card and
+ * more for long songs, so it may run outside of \ref player_lock() while
+ * another song plays. Meanwhile only songs that are read ahead can be read.
+ * The song is not read ahead before \ref songs_start_song() or
+ * \ref songs_queue_song().
  * 
- * @param name name of the file to open (has to end in .wav)
+ * @note \par name is the path from the root folder e.g. "ARTIST/SONG.WAV", as
+ * the library lists it. Its folders and file can have long names too.
+ * @note The WAV file is validated for a sample frequency of 48 kHz, 44.1 kHz
+ * or 32 kHz and correct pcm format. Non conforming files will not be opened.
+ * Songs that are not at 48 kHz are resampled while they are read.
+ * @note The song must not be read at the same time, e.g. close it while
+ * holding \ref player_lock() if it was played.
+ * 
+ * @param name path of the file to open (has to end in .wav)
  * @param[out] song opened song
  * @retval 0 on success
  * @retval -1 on failure
  */
 int songs_open_song(char *name, song_t *song);
 
+/**
+ * @brief Start to read an opened song.
+ * 
+ * Reads ahead its pcm data from the current position on, if its cluster link
+ * map could be built. Songs that were read ahead before are dropped from the
+ * read ahead, also a queued one. Takes no reads of the FAT.
+ * 
+ * @param song a with \ref songs_open_song() opened song
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int songs_start_song(song_t *song);
+
 /**
  * @brief Close song.
  * 
@@ -103,6 +266,14 @@ int songs_close_song(song_t *song);
  * 48 kHz sampled data.
  * @note \par length is relative to the count of samples e.g. halfwords. A
  * length of 1 loads 2 bytes.
+ * @note Reads stop at the end of the pcm data, only there less than \par length
+ * is read.
+ * @note Never waits for the SD-Card if the song is read ahead. If the read
+ * ahead has not caught up yet, the rest of the buffer is filled with silence
+ * and the next read goes on where this one stopped. That counts as a miss in
+ * \ref songs_get_prefetch_stats(). Songs without read ahead are filled with
+ * silence the same way while \ref songs_open_song() or
+ * \ref songs_list_songs() run outside of \ref player_lock().
  * 
  * @param song song to read
  * @param[out] buffer buffer to read into
@@ -112,6 +283,71 @@ int songs_close_song(song_t *song);
  */
 int songs_read_song(song_t *song, int16_t *buffer, size_t *length);
 
+/**
+ * @brief Move the read position of a song.
+ * 
+ * The next \ref songs_read_song() continues at the given sample. With the
+ * cluster link map of a song this takes no reads of the FAT, only its read
+ * ahead has to be refilled.
+ * 
+ * @param song song to seek in
+ * @param sample index of the sample to continue at, rounded down to a stereo
+ *               pair and clipped to the length of the song
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int songs_seek_song(song_t *song, size_t sample);
+
+/**
+ * @brief Queue an opened song to follow the started song.
+ * 
+ * Reads ahead the first block of its pcm data, so it can take over without a
+ * gap. Once it is read with \ref songs_read_song(), both songs share the read
+ * ahead and can be read at the same time, e.g. for a crossfade. The song that
+ * reaches its end first is dropped from the read ahead then. A song that was
+ * queued before and not read yet is replaced. Takes no reads of the FAT, open
+ * the song with \ref songs_open_song() beforehand.
+ * 
+ * @param song a with \ref songs_open_song() opened song, must not be the
+ *             started song
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int songs_queue_song(song_t *song);
+
+/**
+ * @brief Main loop of songs module.
+ * 
+ * Starts the next block of the read ahead if none is in flight. Neither the
+ * interrupt that ends a read nor \ref songs_read_song() start one, so the
+ * read ahead only fills up if this is called regularly. Also hands the stream
+ * of a song that was read to its end over to the other song. Must not run at
+ * the same time as \ref songs_read_song(), e.g. call it while holding
+ * \ref player_lock().
+ * 
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int songs_loop(void);
+
+/**
+ * @brief Get statistics of the read ahead.
+ * 
+ * The read ahead belongs to the song that was started last with
+ * \ref songs_start_song() and the one queued with \ref songs_queue_song().
+ * Songs that are too fragmented for the cluster link map are read without it
+ * and count neither hits nor misses.
+ * 
+ * The throughput is measured from the start to the end of every read. The
+ * headroom compares it to 192000 bytes per second for every song that is
+ * read, below 100 % the SD-Card can't keep up.
+ * 
+ * @param[out] stats current fill level and counters
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+int songs_get_prefetch_stats(songs_prefetch_stats_t *stats);
+
 /**
  * @brief Convert a count of samples into seconds.
  * 
@@ -37,6 +37,18 @@ void delay_ms(uint16_t ms);
  */
 uint32_t get_ticks(void);
 
+/**
+ * @brief Get the current cpu cycle count.
+ * 
+ * After calling \ref utils_init(), the DWT cycle counter of the core is
+ * running. It increments with every cpu clock cycle and wraps around after
+ * 2^32-1 cycles. With 168 MHz this is after about 25 seconds. The difference of
+ * two calls is still correct as long as less time than that passed.
+ * 
+ * @return cycles since utils_init()
+ */
+uint32_t get_cycles(void);
+
 /**
  * @brief Number of available concurrent profilers.
  * 
@@ -150,3 +162,25 @@ static inline uint32_t map_value_u(uint32_t x, uint32_t in_min, uint32_t in_max,
     }
     return ret_val;
 }
+
+/**
+ * @brief Repeat macro m n times with an increasing index, starting at i.
+ * 
+ * Used to build lookup tables at compile time, e.g.
+ * `REP_4(ENTRY, 0)` expands to `ENTRY(0) ENTRY((0) + 1) ... ENTRY((0) + 3)`.
+ * GCC folds math functions of constant arguments like cosf(), so the tables
+ * end up as plain constants in flash.
+ */
+#define REP_1(m, i) m(i)
+#define REP_2(m, i) REP_1(m, i) REP_1(m, (i) + 1)
+#define REP_4(m, i) REP_2(m, i) REP_2(m, (i) + 2)
+#define REP_8(m, i) REP_4(m, i) REP_4(m, (i) + 4)
+#define REP_16(m, i) REP_8(m, i) REP_8(m, (i) + 8)
+#define REP_32(m, i) REP_16(m, i) REP_16(m, (i) + 16)
+#define REP_64(m, i) REP_32(m, i) REP_32(m, (i) + 32)
+#define REP_128(m, i) REP_64(m, i) REP_64(m, (i) + 64)
+#define REP_256(m, i) REP_128(m, i) REP_128(m, (i) + 128)
+#define REP_512(m, i) REP_256(m, i) REP_256(m, (i) + 256)
+#define REP_1024(m, i) REP_512(m, i) REP_512(m, (i) + 512)
+#define REP_2048(m, i) REP_1024(m, i) REP_1024(m, (i) + 1024)
+#define REP_4096(m, i) REP_2048(m, i) REP_2048(m, (i) + 2048)
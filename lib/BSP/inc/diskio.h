@@ -114,10 +114,23 @@ typedef enum {
 	RES_PARERR		/**< 4: Invalid Parameter	*/
 } DRESULT;
 
+/**
+ * \brief	Completion callback of an asynchronous read
+ * \typedef	disk_callback
+ *
+ * \param[in]	res		Result of the read
+ * \param[in]	context	Context given to disk_read_async()
+ */
+typedef void (*disk_callback)(DRESULT res, void *context);
+
 /*----- Function prototypes ------------------------------------------------*/
 DSTATUS disk_initialize (BYTE drv);
 DSTATUS disk_status (BYTE drv);
 DRESULT disk_read (BYTE drv, BYTE*buff, DWORD sector, UINT count);
+DRESULT disk_read_async(BYTE drv, BYTE *buff, DWORD sector, UINT count,
+                        disk_callback callback, void *context);
+int disk_busy(BYTE drv);
+void disk_process_irq(void);
 #if _USE_WRITE
 DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count);
 #endif /* _USE_WRITE */
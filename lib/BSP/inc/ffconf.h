@@ -71,7 +71,7 @@ extern "C" {
  * \arg 0:	Read/Write
  * \arg 1:	Read only
  */
-#define _FS_READONLY	1
+#define _FS_READONLY	0
 
 /**
  * \brief	The _FS_MINIMIZE option defines minimization level to remove API
@@ -114,7 +114,7 @@ extern "C" {
  * \arg 0:	Disable
  * \arg 1:	Enable
  */
-#define	_USE_FASTSEEK	0
+#define	_USE_FASTSEEK	1
 
 /**
  * \brief	To enable volume label functions, set _USE_LABEL to 1.
@@ -199,7 +199,7 @@ extern "C" {
  * for the working buffer, memory management functions, ff_memalloc() and
  * ff_memfree(), must be added to the project.
  */
-#define	_USE_LFN		0
+#define	_USE_LFN		1
 
 /**
  * \brief	Maximum LFN length to handle
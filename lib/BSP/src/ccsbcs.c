@@ -0,0 +1,126 @@
+/**
+ *****************************************************************************
+ * @addtogroup 	FatFs FatFs
+ * @{
+ * @defgroup	FatFs_Unicode Unicode
+ * @brief		Unicode - OEM code conversion for the long file names.
+ * @{
+ *
+ * @file		ccsbcs.c
+ * @date		2026-10-16
+ * @author		Leuenberger Niklaus <leuen4@bfh.ch>
+ *
+ * @brief		Unicode - OEM code conversion of the single byte code page
+ *				1252 (Latin 1), as needed by FatFs with #_USE_LFN set.\n
+ *				FatFs keeps long file names in Unicode on the volume and
+ *				hands them out in the OEM code page of #_CODE_PAGE.
+ * @note		Local, reduced table for this project that only covers code
+ *				page 1252. It is not the ccsbcs.c of the FatFs distribution,
+ *				but has the same interface (ff_convert() and ff_wtoupper()).
+ * @note		Upper case conversion is only done for the Latin, Greek and
+ *				Cyrillic letters. It is used to compare names without regard
+ *				to their case.
+ *
+ *****************************************************************************
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*----- Header-Files -------------------------------------------------------*/
+#include "ff.h"
+
+#if _USE_LFN
+
+#if _CODE_PAGE != 1252
+#error "Only the code page 1252 is supported for long file names."
+#endif
+
+/*----- Data ---------------------------------------------------------------*/
+/**
+ * \brief	Unicode of the characters 0x80 to 0x9F of code page 1252, 0 where
+ *			none is assigned. 0xA0 to 0xFF are the same as in Unicode.
+ */
+static const WCHAR Tbl[] = {
+	0x20AC, 0x0000, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017D, 0x0000,
+	0x0000, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x0000, 0x017E, 0x0178
+};
+
+/*----- Functions ----------------------------------------------------------*/
+/**
+ *****************************************************************************
+ * \brief		Convert a character between Unicode and the OEM code page
+ *
+ * \param[in]	chr		Character code to be converted
+ * \param[in]	dir		0: Unicode to OEM code, 1: OEM code to Unicode
+ * \return		Converted character, 0 if it has no counterpart
+ *****************************************************************************
+ */
+WCHAR ff_convert(WCHAR chr, UINT dir) {
+
+	WCHAR c;
+
+	if (chr < 0x80 || (chr >= 0xA0 && chr < 0x100)) {
+		/* ASCII and Latin 1 are the same */
+		return chr;
+	}
+	if (dir) {
+		/* OEM code to Unicode */
+		return (chr < 0xA0) ? Tbl[chr - 0x80] : 0;
+	}
+	/* Unicode to OEM code */
+	for (c = 0; c < sizeof(Tbl) / sizeof(Tbl[0]); c++) {
+		if (Tbl[c] && chr == Tbl[c]) {
+			return c + 0x80;
+		}
+	}
+	return 0;
+}
+
+/**
+ *****************************************************************************
+ * \brief		Convert a Unicode character to upper case
+ *
+ * \param[in]	chr		Unicode character to be converted
+ * \return		Upper case character, the same if there is none
+ *****************************************************************************
+ */
+WCHAR ff_wtoupper(WCHAR chr) {
+
+	if ((chr >= 'a' && chr <= 'z') ||
+	    (chr >= 0xE0 && chr <= 0xFE && chr != 0xF7) ||	/* Latin 1 */
+	    (chr >= 0x3B1 && chr <= 0x3CB && chr != 0x3C2) ||	/* Greek */
+	    (chr >= 0x430 && chr <= 0x44F) ||				/* Cyrillic */
+	    (chr >= 0xFF41 && chr <= 0xFF5A)) {				/* Fullwidth */
+		return chr - 0x20;
+	}
+	if (chr >= 0x450 && chr <= 0x45F) {
+		/* Cyrillic with diacritics */
+		return chr - 0x50;
+	}
+	if (chr == 0xFF) {
+		return 0x178;
+	}
+	/* Latin Extended-A, pairs of upper and lower case */
+	if ((chr >= 0x100 && chr <= 0x137) || (chr >= 0x14A && chr <= 0x177)) {
+		return (chr & 1) ? chr - 1 : chr;
+	}
+	if ((chr >= 0x139 && chr <= 0x148) || (chr >= 0x179 && chr <= 0x17E)) {
+		return (chr & 1) ? chr : chr - 1;
+	}
+	return chr;
+}
+
+#endif /* _USE_LFN */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+/**
+ * @}
+ * @}
+ */
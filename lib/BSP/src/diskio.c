@@ -51,12 +51,27 @@ extern "C" {
 
 /*----- Macros -------------------------------------------------------------*/
 #define BLOCK_SIZE			512		/**< Block Size in Bytes				*/
+#define SDIO_STATIC_FLAGS	((uint32_t)0x000005FF)	/**< As in the driver	*/
+#define RXACT_TIMEOUT		((uint32_t)0x00010000)	/**< FIFO drain loops	*/
+#define DISK_IRQ_PRIORITY	1		/**< Below the audio DMA (0)			*/
 
 /*----- Data types ---------------------------------------------------------*/
 
 /*----- Function prototypes ------------------------------------------------*/
 
 /*----- Data ---------------------------------------------------------------*/
+/* Transfer state of the SD driver, set by its interrupt handlers */
+extern __IO SD_Error TransferError;
+extern __IO uint32_t DMAEndOfTransfer;
+
+/**
+ * \brief	Asynchronous read in flight
+ */
+static struct {
+	__IO uint8_t busy;			/**< 1: Transfer is running				*/
+	disk_callback callback;		/**< Called on completion				*/
+	void *context;				/**< Passed to the callback				*/
+} async;
 
 /*----- Implementation -----------------------------------------------------*/
 /**
@@ -89,6 +104,13 @@ DSTATUS disk_initialize(BYTE drv) {
 		stat |= STA_NOINIT;
 	}
 
+	/* Completion of asynchronous reads is signalled by the DMA. Both
+	 * interrupts end transfers with a command to the card, the audio DMA
+	 * must be able to interrupt them. */
+	NVIC_SetPriority(SDIO_IRQn, DISK_IRQ_PRIORITY);
+	NVIC_SetPriority(SD_SDIO_DMA_IRQn, DISK_IRQ_PRIORITY);
+	NVIC_EnableIRQ(SD_SDIO_DMA_IRQn);
+
 	return (stat);
 }
 
@@ -135,6 +157,10 @@ DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, UINT count) {
 	if (SD_Detect() != SD_PRESENT )
 		return (RES_NOTRDY);
 
+	/* Let an asynchronous read finish first */
+	while (async.busy)
+		;
+
 	/* DMA Alignment failure, do single up to aligned buffer */
 	if ((DWORD) buff & 3) {
 		DRESULT res = RES_OK;
@@ -176,6 +202,106 @@ DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, UINT count) {
 		return (RES_ERROR);
 }
 
+/**
+ *****************************************************************************
+ * \brief		Start a read from the SD Card without waiting for it\n
+ *				The callback is called from the interrupt that ends the
+ *				transfer. Only one asynchronous read can be in flight.
+ *				Waits for the card to finish the previous transfer, so it
+ *				must not be called from an interrupt, the callback included.
+ *
+ * \param[in]	drv		Physical drive number (0..)
+ * \param[out]	buff	Data buffer to store read data, has to be word
+ *						aligned and must stay valid until the callback
+ * \param[in]	sector	Sector address (LBA)
+ * \param[in]	count	Number of sectors to read (1..128)
+ * \param[in]	callback	Called with the result once the read is done
+ * \param[in]	context	Passed to the callback
+ * \return		DRESULT of starting the read
+ *****************************************************************************
+ */
+DRESULT disk_read_async(BYTE drv, BYTE *buff, DWORD sector, UINT count,
+                        disk_callback callback, void *context) {
+
+#ifdef DBGIO
+	printf("disk_read_async %d %p %10d %d\n",drv,buff,sector,count);
+#endif
+
+	if (drv || !callback || ((DWORD) buff & 3))
+		return (RES_PARERR);
+
+	if (SD_Detect() != SD_PRESENT )
+		return (RES_NOTRDY);
+
+	if (async.busy)
+		return (RES_NOTRDY);
+
+	/* The card has to be back in transfer state from the previous read */
+	while (SD_GetStatus() == SD_TRANSFER_BUSY)
+		;
+
+	async.callback = callback;
+	async.context = context;
+	DMAEndOfTransfer = 0;
+	async.busy = 1;
+
+	/* 4GB Compliant */
+	if (SD_ReadMultiBlocksFIXED(buff, sector, BLOCK_SIZE, count) != SD_OK) {
+		async.busy = 0;
+		return (RES_ERROR);
+	}
+
+	return (RES_OK);
+}
+
+/**
+ *****************************************************************************
+ * \brief		Check for an asynchronous read in flight
+ *
+ * \param[in]	drv		Physical drive number (0..)
+ * \return		1 if a read is in flight, 0 otherwise
+ *****************************************************************************
+ */
+int disk_busy(BYTE drv) {
+	return (!drv && async.busy);
+}
+
+/**
+ *****************************************************************************
+ * \brief		Finish an asynchronous read\n
+ *				Has to be called from the SDIO and the SDIO DMA interrupt
+ *				after the driver has processed them. Does the same as
+ *				SD_WaitReadOperation() once the transfer has ended and then
+ *				calls the callback.
+ *****************************************************************************
+ */
+void disk_process_irq(void) {
+
+	DRESULT res = RES_OK;
+	disk_callback callback = async.callback;
+	void *context = async.context;
+	uint32_t timeout = RXACT_TIMEOUT;
+
+	/* Not ours or still running */
+	if (!async.busy || (!DMAEndOfTransfer && TransferError == SD_OK))
+		return;
+
+	DMAEndOfTransfer = 0;
+
+	/* Last words may still be in the FIFO */
+	while ((SDIO->STA & SDIO_FLAG_RXACT) && timeout > 0)
+		timeout--;
+
+	if ((SD_StopTransfer() != SD_OK) || (TransferError != SD_OK)
+	        || (timeout == 0))
+		res = RES_ERROR;
+
+	SDIO_ClearFlag(SDIO_STATIC_FLAGS);
+
+	async.busy = 0;
+	callback(res, context);
+}
+
 #if _USE_WRITE
 /**
  *****************************************************************************
@@ -199,6 +325,10 @@ DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count) {
 	if (SD_Detect() != SD_PRESENT )
 		return (RES_NOTRDY);
 
+	/* Let an asynchronous read finish first */
+	while (async.busy)
+		;
+
 	/* DMA Alignment failure, do single up to aligned buffer */
 	if ((DWORD) buff & 3) {
 		DRESULT res = RES_OK;
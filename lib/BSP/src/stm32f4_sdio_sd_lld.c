@@ -19,6 +19,7 @@ extern "C" {
 
 #include "stm32f4xx.h"
 #include "stm32f4_sdio_sd.h"
+#include "diskio.h"
 
 /**
  * @brief	DeInitializes the SDIO interface.\n
@@ -222,6 +223,7 @@ void SD_LowLevel_DMA_RxConfig(uint32_t *BufferDST, uint32_t BufferSize) {
  */
 void SDIO_IRQHandler(void) {
 	SD_ProcessIRQSrc();
+	disk_process_irq();
 }
 
 /**
@@ -229,6 +231,7 @@ void SDIO_IRQHandler(void) {
  */
 void SD_SDIO_DMA_IRQHANDLER(void) {
 	SD_ProcessDMAIRQ();
+	disk_process_irq();
 }
 
 /**
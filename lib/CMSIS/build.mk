@@ -1,4 +1,8 @@
 CFLAGS_INC += -I$(LIBDIR)/$(CMSISDIR)/Device/ST/STM32F4xx/Include
 CFLAGS_INC += -I$(LIBDIR)/$(CMSISDIR)/Include
+CFLAGS_DEF += -DARM_MATH_CM4
+
+# precompiled DSP library for Cortex-M4 with hardware FPU
+LDLIBS += -L$(LIBDIR)/$(CMSISDIR)/Lib/GCC -larm_cortexM4lf_math
 
 #SRCS_ASM += $(LIBDIR)/$(CMSISDIR)/Device/ST/STM32F4xx/Source/Templates/TrueSTUDIO/startup_stm32f40xx.s
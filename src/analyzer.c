@@ -0,0 +1,103 @@
+/**
+ * @file analyzer.c
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Module for the deferred analysis of played audio blocks.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ * 
+ * Blocks are passed from the producer (player refill) to the consumer (main
+ * loop) over a single-producer single-consumer ring buffer. The write index is
+ * only written by the producer and the read index only by the consumer, so no
+ * locking is needed even if the producer runs in an interrupt.
+ */
+
+#include <stm32f4xx.h>
+#include <string.h>
+
+#include "analyzer.h"
+
+#if ((ANALYZER_QUEUE_DEPTH & (ANALYZER_QUEUE_DEPTH - 1)) != 0)
+#error "ANALYZER_QUEUE_DEPTH has to be a power of two."
+#endif
+
+static analyzer_callback g_callback; //!< user callback to analyze a block
+
+/**
+ * @brief Queued blocks.
+ * 
+ * Word aligned so that the analysis can load two samples at once.
+ */
+static int16_t g_queue[ANALYZER_QUEUE_DEPTH][PLAYER_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint32_t g_timestamps[ANALYZER_QUEUE_DEPTH]; //!< timestamps of queued blocks
+
+static struct {
+    __IO uint32_t head;     //!< count of pushed blocks, written by producer
+    __IO uint32_t tail;     //!< count of consumed blocks, written by consumer
+    __IO uint32_t rejected; //!< blocks dropped by producer, queue was full
+    __IO uint32_t skipped;  //!< blocks only folded in by consumer, were too old
+} g_indices;
+
+int analyzer_init(analyzer_callback callback) {
+    if (!callback) {
+        return -1;
+    }
+    g_callback = callback;
+    return 0;
+}
+
+int analyzer_push(const int16_t *samples, size_t length, uint32_t timestamp) {
+    uint32_t head = g_indices.head;
+    if (head - g_indices.tail >= ANALYZER_QUEUE_DEPTH) {
+        // Full, the consumer is still working on the oldest block. Under either
+        // policy the new block is dropped, the others may be in use.
+        g_indices.rejected++;
+        return -1;
+    }
+    int16_t *block = g_queue[head & (ANALYZER_QUEUE_DEPTH - 1)];
+    if (length > PLAYER_BUFFER_SIZE) {
+        length = PLAYER_BUFFER_SIZE;
+    }
+    memcpy(block, samples, length * sizeof(int16_t));
+    memset(block + length, 0, (PLAYER_BUFFER_SIZE - length) * sizeof(int16_t));
+    g_timestamps[head & (ANALYZER_QUEUE_DEPTH - 1)] = timestamp;
+    // make sure the block is written before the consumer can see it
+    __DMB();
+    g_indices.head = head + 1;
+    return 0;
+}
+
+int analyzer_loop(void) {
+    if (!g_callback) {
+        return -1;
+    }
+    uint32_t tail = g_indices.tail;
+    uint32_t head = g_indices.head;
+    if (head == tail) {
+        // nothing queued
+        return 0;
+    }
+    // don't read the blocks before the index that published them
+    __DMB();
+#if (ANALYZER_DROP_POLICY == ANALYZER_DROP_OLDEST)
+    // Only the newest block is of interest. The older ones are still passed
+    // on, the analysis has state that spans blocks and would otherwise splice
+    // audio that does not belong together.
+    for (; tail + 1 != head; ++tail) {
+        g_callback(g_queue[tail & (ANALYZER_QUEUE_DEPTH - 1)], g_timestamps[tail & (ANALYZER_QUEUE_DEPTH - 1)], 0);
+        g_indices.skipped++;
+        __DMB();
+        g_indices.tail = tail + 1;
+    }
+#endif
+    g_callback(g_queue[tail & (ANALYZER_QUEUE_DEPTH - 1)], g_timestamps[tail & (ANALYZER_QUEUE_DEPTH - 1)], 1);
+    // free the block only after it was analyzed
+    __DMB();
+    g_indices.tail = tail + 1;
+    return 0;
+}
+
+uint32_t analyzer_get_dropped(void) {
+    return g_indices.rejected + g_indices.skipped;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file decimator.c
+ * @author Reusser Adrian <reusa1@bfh.ch>
+ * @brief Module for the anti aliasing decimator in front of the dft.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Adrian Reusser
+ * 
+ * Theoretical source for this implementation:
+ * https://en.wikipedia.org/wiki/Sinc_filter
+ * https://en.wikipedia.org/wiki/Window_function#Blackman_window
+ */
+
+#include "decimator.h"
+#include "simd.h"
+#include "utils.h"
+#include <math.h>
+#include <string.h>
+
+#if (DECIMATOR_RATIO != 1) && (DECIMATOR_RATIO % 2 != 0)
+#error "DECIMATOR_RATIO has to be one or an even number."
+#endif
+
+#if (DECIMATOR_TAPS == 16)
+#define DECIMATOR_REP_TAPS(m) REP_16(m, 0)
+#elif (DECIMATOR_TAPS == 32)
+#define DECIMATOR_REP_TAPS(m) REP_32(m, 0)
+#elif (DECIMATOR_TAPS == 64)
+#define DECIMATOR_REP_TAPS(m) REP_64(m, 0)
+#elif (DECIMATOR_TAPS == 128)
+#define DECIMATOR_REP_TAPS(m) REP_128(m, 0)
+#else
+#error "DECIMATOR_TAPS has to be a power of two between 16 and 128."
+#endif
+
+// Below that the sinc is cut off too early and the gain at DC drops noticeably
+// below one. Above that the sum of the absolute taps gets larger than two and
+// the 32 bit accumulator could overflow.
+#if (DECIMATOR_RATIO != 1) && ((DECIMATOR_TAPS < 8 * DECIMATOR_RATIO) || (DECIMATOR_TAPS > 32 * DECIMATOR_RATIO))
+#error "DECIMATOR_TAPS has to be between 8 and 32 times DECIMATOR_RATIO."
+#endif
+
+#define DECIMATOR_PI (3.14159265358979323846f)
+
+/**
+ * @brief Cutoff of the lowpass relative to the input sample rate.
+ * 
+ * 80 % of the nyquist frequency after decimation, the rest is the transition
+ * band. With 64 taps and a ratio of four everything that would alias is
+ * attenuated by about 80 dB, at the cost of the topmost bins.
+ */
+#define DECIMATOR_CUTOFF (0.8f / (2 * DECIMATOR_RATIO))
+
+// Windowed sinc of tap i. The length is even, so the center lies between two
+// taps and the sinc never has to be evaluated at zero.
+#define DECIMATOR_CENTER ((DECIMATOR_TAPS - 1) / 2.0f)
+#define DECIMATOR_SINC(i) \
+    (sinf(2 * DECIMATOR_PI * DECIMATOR_CUTOFF * ((i) - DECIMATOR_CENTER)) / (DECIMATOR_PI * ((i) - DECIMATOR_CENTER)))
+#define DECIMATOR_WINDOW(i) \
+    (0.42f - 0.5f * cosf(2 * DECIMATOR_PI * (i) / (DECIMATOR_TAPS - 1)) + 0.08f * cosf(4 * DECIMATOR_PI * (i) / (DECIMATOR_TAPS - 1)))
+#define DECIMATOR_TAP(i) (DECIMATOR_SINC(i) * DECIMATOR_WINDOW(i))
+
+#define DECIMATOR_TAP_ENTRY(i) (int16_t) roundf(32768.0f * DECIMATOR_TAP(i)),
+
+/**
+ * @brief Taps of the FIR lowpass in Q15 format.
+ * 
+ * Generated at compile time. Word aligned so that two taps at once can be
+ * loaded by SIMD instructions. Their sum, e.g. the gain at DC, is one within
+ * a few per mille.
+ */
+static const int16_t g_taps[DECIMATOR_TAPS] __attribute__((aligned(4))) = {DECIMATOR_REP_TAPS(DECIMATOR_TAP_ENTRY)};
+
+void decimator_init(decimator_t *decimator, int channel) {
+    memset(decimator->samples, 0, sizeof(decimator->samples));
+    decimator->channel = channel;
+}
+
+void decimator_process(decimator_t *decimator, const int16_t *samples, int16_t *decimated) {
+#if (DECIMATOR_RATIO == 1)
+    // nothing to filter away
+    for (int n = 0; n < DECIMATOR_OUTPUT_SIZE; ++n) {
+        decimated[n] = samples[decimator->channel + 2 * n];
+    }
+#else
+    // Append the selected channel to the samples of the previous block, so
+    // that the filter runs over consecutive memory.
+    int16_t *x = decimator->samples;
+    for (int n = 0; n < DECIMATOR_INPUT_SIZE / 2; ++n) {
+        x[DECIMATOR_HISTORY_SIZE + n] = samples[decimator->channel + 2 * n];
+    }
+    // Output m is the filter over the inputs m * ratio up to m * ratio + taps -
+    // 1. Ratio and history size are even, so every window starts word aligned
+    // and two samples can be multiplied with two taps by a single SMLAD.
+    for (int m = 0; m < DECIMATOR_OUTPUT_SIZE; ++m) {
+        const int16_t *window = x + m * DECIMATOR_RATIO;
+        int32_t acc = 1 << 14; // round instead of truncate
+        for (int k = 0; k < DECIMATOR_TAPS / 2; ++k) {
+            acc = __SMLAD(read_q15x2(window + 2 * k), read_q15x2(g_taps + 2 * k), acc);
+        }
+        acc >>= 15;
+        decimated[m] = (acc > INT16_MAX) ? INT16_MAX : (acc < INT16_MIN) ? INT16_MIN : acc;
+    }
+    // keep the end of the block for the next call
+    memmove(x, x + DECIMATOR_INPUT_SIZE / 2, DECIMATOR_HISTORY_SIZE * sizeof(int16_t));
+#endif
+}
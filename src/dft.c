@@ -2,23 +2,64 @@
  * @file dft.c
  * @author Reusser Adrian <reusa1@bfh.ch>
  * @brief Module for calculating a discrete fourier transform.
- * @version 0.1
+ * @version 0.2
  * @date 2022-01-14
  * 
  * @copyright Copyright (c) 2022 Adrian Reusser
  *
  * Theoretical source for this implementation:
  * https://batchloaf.wordpress.com/2013/12/07/simple-dft-in-c/
+ * https://en.wikipedia.org/wiki/Cooley%E2%80%93Tukey_FFT_algorithm
  */
 
 
 #include "dft.h"
+#include "decimator.h"
+#include "utils.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_Q15)
+#include "simd.h"
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_F32) || DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_Q15)
+#include <stm32f4xx.h>
+#include <arm_math.h>
+#endif
 
 #define PI2 (6.2832f)
 
+/**
+ * @brief Length of the sample window that is kept between calls.
+ * 
+ * Either a whole block or, if a single transform needs more samples than a
+ * block has, the last DFT_N samples.
+ */
+#define DFT_BUFFER_SIZE ((DFT_BLOCK_SIZE >= DFT_N) ? DFT_BLOCK_SIZE : DFT_N)
+
+#if (DFT_CHANNELS_NUM == 2) && ((DFT_BACKEND != DFT_BACKEND_FFT) || defined(DFT_BENCHMARK))
+#error "DFT_CHANNEL_STEREO needs DFT_BACKEND_FFT and can't be benchmarked."
+#endif
+
+/**
+ * @brief Undersampled samples of the selected channel(s).
+ * 
+ * Is filled in by \ref dft_update() and then split into DFT_PARTS_NUM
+ * batches of DFT_N samples that are transformed one after the other. Word
+ * aligned so that two samples at once can be loaded by SIMD instructions. In
+ * stereo mode the window of the right channel follows the left one.
+ */
+static int16_t g_samples[DFT_CHANNELS_NUM][DFT_BUFFER_SIZE] __attribute__((aligned(4)));
+
+/**
+ * @brief Anti aliasing decimators of the selected channel(s).
+ * 
+ */
+static decimator_t g_decimator[DFT_CHANNELS_NUM];
+
 /**
  * @brief Twiddle factors of cosine.
  * 
@@ -28,60 +69,816 @@
  */
 float g_twiddle_factors[DFT_N];
 
+#if (DFT_BANDS_NUM >= DFT_MAGNITUDE_SIZE)
+#error "DFT_BANDS_NUM has to be smaller than DFT_MAGNITUDE_SIZE."
+#endif
+
+/**
+ * @brief First bin of every band, the last entry is the end of the last band.
+ * 
+ * @note The values are only valid after a call to \ref dft_init has been made.
+ */
+static uint16_t g_band_edges[DFT_BANDS_NUM + 1];
+
+// Repeat a macro DFT_N or DFT_N / 2 times, see REP_n() of utils.h. Used to
+// build the lookup tables of the FFT and Q15 backends and of the windows at
+// compile time.
+#if (DFT_N == 64)
+#define DFT_LOG2_N (6)
+#define DFT_REP_N(m) REP_64(m, 0)
+#define DFT_REP_HALF_N(m) REP_32(m, 0)
+#elif (DFT_N == 128)
+#define DFT_LOG2_N (7)
+#define DFT_REP_N(m) REP_128(m, 0)
+#define DFT_REP_HALF_N(m) REP_64(m, 0)
+#elif (DFT_N == 256)
+#define DFT_LOG2_N (8)
+#define DFT_REP_N(m) REP_256(m, 0)
+#define DFT_REP_HALF_N(m) REP_128(m, 0)
+#elif (DFT_N == 512)
+#define DFT_LOG2_N (9)
+#define DFT_REP_N(m) REP_512(m, 0)
+#define DFT_REP_HALF_N(m) REP_256(m, 0)
+#elif (DFT_N == 1024)
+#define DFT_LOG2_N (10)
+#define DFT_REP_N(m) REP_1024(m, 0)
+#define DFT_REP_HALF_N(m) REP_512(m, 0)
+#endif
+
+#if !defined(DFT_LOG2_N) && (DFT_BACKEND_ENABLED(DFT_BACKEND_FFT) || DFT_BACKEND_ENABLED(DFT_BACKEND_Q15))
+#error "DFT_N has to be a power of two between 64 and 1024 for the FFT and Q15."
+#endif
+
+#define DFT_2PI (6.28318530717958647692f)
+
+// Coefficients of the windows. All of them are cosine sums of the form
+// w(n) = a0 - a1 * cos(2 * pi * n / N) + a2 * cos(4 * pi * n / N) - ...
+// See https://en.wikipedia.org/wiki/Window_function#Cosine-sum_windows
+#if (DFT_WINDOW == DFT_WINDOW_RECTANGULAR)
+#define WINDOW_TERMS (1)
+#define WINDOW_A0 (1.0f)
+#elif (DFT_WINDOW == DFT_WINDOW_HANN)
+#define WINDOW_TERMS (2)
+#define WINDOW_A0 (0.5f)
+#define WINDOW_A1 (0.5f)
+#elif (DFT_WINDOW == DFT_WINDOW_BLACKMAN_HARRIS)
+#define WINDOW_TERMS (4)
+#define WINDOW_A0 (0.35875f)
+#define WINDOW_A1 (0.48829f)
+#define WINDOW_A2 (0.14128f)
+#define WINDOW_A3 (0.01168f)
+#elif (DFT_WINDOW == DFT_WINDOW_FLAT_TOP)
+#define WINDOW_TERMS (5)
+#define WINDOW_A0 (0.21557895f)
+#define WINDOW_A1 (0.41663158f)
+#define WINDOW_A2 (0.277263158f)
+#define WINDOW_A3 (0.083578947f)
+#define WINDOW_A4 (0.006947368f)
+#else
+#error "DFT_WINDOW has to be one of the DFT_WINDOW_* values."
+#endif
+#ifndef WINDOW_A1
+#define WINDOW_A1 (0.0f)
+#endif
+#ifndef WINDOW_A2
+#define WINDOW_A2 (0.0f)
+#endif
+#ifndef WINDOW_A3
+#define WINDOW_A3 (0.0f)
+#endif
+#ifndef WINDOW_A4
+#define WINDOW_A4 (0.0f)
+#endif
+
+#define WINDOW(i)                                                     \
+    (WINDOW_A0 - WINDOW_A1 * cosf(1 * DFT_2PI * (i) / DFT_N) +        \
+     WINDOW_A2 * cosf(2 * DFT_2PI * (i) / DFT_N) -                    \
+     WINDOW_A3 * cosf(3 * DFT_2PI * (i) / DFT_N) +                    \
+     WINDOW_A4 * cosf(4 * DFT_2PI * (i) / DFT_N))
+
+#if (DFT_WINDOW != DFT_WINDOW_RECTANGULAR)
+
+#ifndef DFT_LOG2_N
+#error "DFT_N has to be a power of two between 64 and 1024 for windowing."
+#endif
+
+#define WINDOW_ENTRY(i) WINDOW(i),
+#define WINDOW_Q15_ENTRY(i) (int16_t) roundf(32767.0f * WINDOW(i)),
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_C) || DFT_BACKEND_ENABLED(DFT_BACKEND_ASM) || \
+    DFT_BACKEND_ENABLED(DFT_BACKEND_FFT) || DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_F32)
+/**
+ * @brief Window that is applied to the samples before the transform.
+ * 
+ * Generated at compile time, see \ref DFT_WINDOW. Not static, as the ASM
+ * backend uses it too.
+ */
+const float g_window[DFT_N] = {DFT_REP_N(WINDOW_ENTRY)};
+#define WINDOW_F32(n) (g_window[n])
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_Q15) || DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_Q15)
+/**
+ * @brief Window in Q15 format, the same as \ref g_window.
+ * 
+ */
+static const int16_t g_window_q15[DFT_N] = {DFT_REP_N(WINDOW_Q15_ENTRY)};
+
+/**
+ * @brief Multiply a sample with the Q15 window.
+ * 
+ * @param samples samples of a transform
+ * @param n index of the sample
+ * @return windowed sample
+ */
+static inline int16_t window_q15(const int16_t *samples, int n) {
+    return (samples[n] * g_window_q15[n] + (1 << 14)) >> 15;
+}
+#endif
+
+#else
+// no window, the multiplication is optimized away
+#define WINDOW_F32(n) (1.0f)
+#endif // DFT_WINDOW != DFT_WINDOW_RECTANGULAR
+
+/**
+ * @brief Scale from the power of a bin to its magnitude, 1 / (DFT_N * a0)^2.
+ * 
+ * A sine of amplitude A in the center of a bin then has the magnitude
+ * (A / 2)^2, whatever the length of the transform or the window. Not static,
+ * as the ASM backend uses it too.
+ */
+const float g_power_scale = 1.0f / ((DFT_N * WINDOW_A0) * (DFT_N * WINDOW_A0));
+
+/**
+ * @brief Power of a full scale sine in a band, the top of the band levels.
+ * 
+ * The window spreads a sine over a few bins, their sum is its magnitude times
+ * the equivalent noise bandwidth of the window in bins, e.g. 1.5 for Hann.
+ */
+#define BAND_FULL_SCALE_POWER                                                                                  \
+    (32768.0f / 2 * 32768.0f / 2 *                                                                             \
+     (WINDOW_A0 * WINDOW_A0 +                                                                                  \
+      (WINDOW_A1 * WINDOW_A1 + WINDOW_A2 * WINDOW_A2 + WINDOW_A3 * WINDOW_A3 + WINDOW_A4 * WINDOW_A4) / 2) / \
+     (WINDOW_A0 * WINDOW_A0))
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_FFT)
+
+// Reverse the lower 10 bits of i and then shift the result to the actually
+// used DFT_LOG2_N bits.
+#define FFT_BITREV(i) \
+    ((((((i) & 0x001) << 9) | (((i) & 0x002) << 7) | (((i) & 0x004) << 5) | \
+       (((i) & 0x008) << 3) | (((i) & 0x010) << 1) | (((i) & 0x020) >> 1) | \
+       (((i) & 0x040) >> 3) | (((i) & 0x080) >> 5) | (((i) & 0x100) >> 7) | \
+       (((i) & 0x200) >> 9))) >>                                            \
+     (10 - DFT_LOG2_N))
+
+// Table entries, GCC folds the cosf() / sinf() of constant values at compile
+// time so the tables end up as plain constants in flash.
+#define FFT_BITREV_ENTRY(i) FFT_BITREV(i),
+#define FFT_COS_ENTRY(i) cosf(DFT_2PI * (i) / DFT_N),
+#define FFT_SIN_ENTRY(i) sinf(DFT_2PI * (i) / DFT_N),
+
+/**
+ * @brief Bit reversed indices.
+ * 
+ * Sample n is loaded to position g_fft_bitrev[n] of the FFT buffer. This
+ * replaces the reordering pass of the in-place FFT.
+ */
+static const uint16_t g_fft_bitrev[DFT_N] = {DFT_REP_N(FFT_BITREV_ENTRY)};
+
+/**
+ * @brief Cosine part of the twiddle factors W^k = e^(-j * 2 * pi * k / N).
+ * 
+ */
+static const float g_fft_cos[DFT_N / 2] = {DFT_REP_HALF_N(FFT_COS_ENTRY)};
+
+/**
+ * @brief Negated sine part of the twiddle factors W^k = e^(-j * 2 * pi * k / N).
+ * 
+ */
+static const float g_fft_sin[DFT_N / 2] = {DFT_REP_HALF_N(FFT_SIN_ENTRY)};
+
+/**
+ * @brief Working buffer of the FFT, interleaved real and imaginary parts.
+ * 
+ */
+static float g_fft[2 * DFT_N];
+
+/**
+ * @brief Run the in-place radix-2 decimation in time FFT on \ref g_fft.
+ * 
+ * The input has to be already in bit reversed order.
+ */
+static void fft_run(void);
+
+#if (DFT_CHANNELS_NUM == 2)
+/**
+ * @brief Transform both channels with a single complex FFT.
+ * 
+ * The left channel is loaded as real and the right as imaginary part. As
+ * the spectrum of a real signal is conjugate symmetric, the two spectra can
+ * be separated again from the bins k and N - k.
+ * 
+ * @param samples DFT_N samples of the left channel, the right channel follows
+ *                DFT_BUFFER_SIZE samples later
+ * @param[out] magnitude the magnitudes of both spectra, 2 * DFT_MAGNITUDE_SIZE
+ */
+static void transform_part_fft_stereo(int16_t *samples, uint32_t *magnitude);
+#endif
+
+#endif // DFT_BACKEND_ENABLED(DFT_BACKEND_FFT)
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_Q15)
+
+#define Q15_COS_ENTRY(i) (int16_t) roundf(32767.0f * cosf(DFT_2PI * (i) / DFT_N)),
+
+/**
+ * @brief Cosine twiddle factors in Q15 format, e.g. the n-th roots of unity.
+ * 
+ * The same as \ref g_twiddle_factors but generated at compile time. The sine
+ * is at offset \ref DFT_SIN_OFFSET.
+ */
+static const int16_t g_twiddle_factors_q15[DFT_N] = {DFT_REP_N(Q15_COS_ENTRY)};
+
+#if (DFT_WINDOW != DFT_WINDOW_RECTANGULAR)
+/**
+ * @brief Windowed samples of the Q15 backend, word aligned for SIMD.
+ * 
+ */
+static int16_t g_q15_windowed[DFT_N] __attribute__((aligned(4)));
+#endif
+
+#endif // DFT_BACKEND_ENABLED(DFT_BACKEND_Q15)
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_F32) || DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_Q15)
+#if ((DFT_N & (DFT_N - 1)) != 0) || (DFT_N < 64) || (DFT_N > 1024)
+#error "DFT_N has to be a power of two between 64 and 1024 for CMSIS-DSP."
+#endif
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_F32)
+static arm_rfft_fast_instance_f32 g_rfft_f32; //!< CMSIS instance for f32 rfft
+static float32_t g_rfft_f32_in[DFT_N];        //!< input, used as scratch by CMSIS
+static float32_t g_rfft_f32_out[DFT_N];       //!< packed complex output
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_Q15)
+static arm_rfft_instance_q15 g_rfft_q15; //!< CMSIS instance for q15 rfft
+static q15_t g_rfft_q15_in[DFT_N];       //!< input, may be modified by CMSIS
+static q15_t g_rfft_q15_out[2 * DFT_N];  //!< complex output
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_SLIDING)
+
+/**
+ * @brief How many bins the sliding dft keeps.
+ * 
+ * One more than there are magnitudes, the window needs the neighbouring bin at
+ * the nyquist frequency.
+ */
+#define SLIDING_BINS (DFT_MAGNITUDE_SIZE + 1)
+
+/**
+ * @brief Running bins of the sliding dft, interleaved real and imaginary parts.
+ * 
+ */
+static float g_sdft[2 * SLIDING_BINS];
+
+/**
+ * @brief Rotation of every bin per sample, r * e^(j * 2 * pi * k / N).
+ * 
+ * Interleaved real and imaginary parts, r is \ref DFT_SLIDING_DAMPING.
+ * @note The values are only valid after a call to \ref dft_init has been made.
+ */
+static float g_sdft_rotation[2 * SLIDING_BINS];
+
+/**
+ * @brief Weight of the sample that leaves the window, r^N.
+ * 
+ */
+static float g_sdft_damping_n;
+
+/**
+ * @brief The last DFT_N samples, needed to remove them again from the bins.
+ * 
+ */
+static int16_t g_sdft_history[DFT_N];
+static int g_sdft_oldest; //!< index of the oldest sample in g_sdft_history
+
+#if (DFT_WINDOW != DFT_WINDOW_RECTANGULAR)
+/**
+ * @brief The bins of the sliding dft rotated back to the phase of a dft.
+ * 
+ */
+static float g_sdft_spectrum[2 * SLIDING_BINS];
+
+/**
+ * @brief Weight of the bins k and k +/- i when windowing in the frequency
+ * domain, e.g. a0, -a1 / 2, a2 / 2, -a3 / 2 and a4 / 2.
+ * 
+ */
+static const float g_window_terms[5] = {WINDOW_A0, -WINDOW_A1 / 2, WINDOW_A2 / 2, -WINDOW_A3 / 2, WINDOW_A4 / 2};
+#endif
+
+/**
+ * @brief Fold new samples into the running bins of the sliding dft.
+ * 
+ * For every sample x(n) all bins are updated with
+ * S(n) = x(n) - r^N * x(n - N) + r * e^(j * 2 * pi * k / N) * S(n - 1)
+ * which has the same magnitude as a dft over the last N samples.
+ * 
+ * @param[in] samples new samples of the selected channel
+ * @param count how many samples there are
+ */
+static void sliding_update(const int16_t *samples, int count);
+
 /**
- * @brief Implementation for the dft.
+ * @brief Read the magnitudes out of the running bins of the sliding dft.
  * 
- * Depending it the \ref DFT_USE_ASM macro is defined, the ASM or the C
- * implementation will be used for this.
+ * @param[out] magnitude array with magnitudes DFT_MAGNITUDE_SIZE in length
+ */
+static void sliding_read(uint32_t *magnitude);
+
+#endif // DFT_BACKEND_ENABLED(DFT_BACKEND_SLIDING)
+
+/**
+ * @brief Prototype of a backend implementation for the dft.
  * 
- * @param samples samples with a lenght of 2 * N * DFT_UNDER_SAMPLING
+ * @param samples DFT_N consecutive samples of the selected channel
  * @param[out] magnitude the calculated magnitudes of length DFT_MAGNITUDE_SIZE
  */
-#ifndef DFT_USE_ASM
-static void transform_part(int16_t *samples, uint32_t *magnitude);
+typedef void (*transform_part_t)(int16_t *samples, uint32_t *magnitude);
+
+// Implementations for the dft, one per backend. Only those selected with
+// DFT_BACKEND (or all for DFT_BENCHMARK) are compiled in.
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_C)
+static void transform_part_c(int16_t *samples, uint32_t *magnitude);
+#endif
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_ASM)
+extern void transform_part_asm(int16_t *samples, uint32_t *magnitude);
+#endif
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_FFT) && (DFT_CHANNELS_NUM == 1)
+static void transform_part_fft(int16_t *samples, uint32_t *magnitude);
+#endif
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_F32)
+static void transform_part_cmsis_f32(int16_t *samples, uint32_t *magnitude);
+#endif
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_Q15)
+static void transform_part_cmsis_q15(int16_t *samples, uint32_t *magnitude);
+#endif
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_Q15)
+static void transform_part_q15(int16_t *samples, uint32_t *magnitude);
+#endif
+
+#if (DFT_BACKEND == DFT_BACKEND_C)
+#define transform_part transform_part_c
+#elif (DFT_BACKEND == DFT_BACKEND_ASM)
+#define transform_part transform_part_asm
+#elif (DFT_BACKEND == DFT_BACKEND_FFT) && (DFT_CHANNELS_NUM == 2)
+#define transform_part transform_part_fft_stereo
+#elif (DFT_BACKEND == DFT_BACKEND_FFT)
+#define transform_part transform_part_fft
+#elif (DFT_BACKEND == DFT_BACKEND_CMSIS_F32)
+#define transform_part transform_part_cmsis_f32
+#elif (DFT_BACKEND == DFT_BACKEND_CMSIS_Q15)
+#define transform_part transform_part_cmsis_q15
+#elif (DFT_BACKEND == DFT_BACKEND_Q15)
+#define transform_part transform_part_q15
+#elif (DFT_BACKEND == DFT_BACKEND_SLIDING)
+// not block based, see sliding_update() and sliding_read()
 #else
-extern void transform_part(int16_t *samples, uint32_t *magnitude);
+#error "DFT_BACKEND has to be one of the DFT_BACKEND_* values."
 #endif
 
+/**
+ * @brief Append the undersampled samples of the selected channel(s) to
+ * \ref g_samples.
+ * 
+ * @param[in] samples arrary with samples of length DFT_SAMPLE_SIZE
+ * @return pointer to the DFT_BLOCK_SIZE new samples of the first channel
+ */
+static inline int16_t *gather(int16_t *samples);
+
+/**
+ * @brief Calculate the dft magnitudes of \ref g_samples with a backend.
+ * 
+ * Common part of \ref dft_get_magnitude() and \ref dft_benchmark().
+ * 
+ * @param part backend implementation
+ * @param[out] magnitude array with magnitudes DFT_CHANNELS_NUM *
+ *                       DFT_MAGNITUDE_SIZE in length
+ */
+static inline void analyze(transform_part_t part, uint32_t *magnitude);
+
+/**
+ * @brief Convert a power value to a magnitude with \ref g_power_scale and
+ * clamp it to the range of uint32_t.
+ * 
+ * @param P power value
+ * @return magnitude
+ */
+static inline uint32_t clamp_magnitude(float P) {
+    P *= g_power_scale;
+    return (P < (float)UINT32_MAX) ? (uint32_t)P : UINT32_MAX;
+}
+
 void dft_init(void) {
+#if (DFT_CHANNELS_NUM == 2)
+    decimator_init(&g_decimator[0], DFT_CHANNEL_LEFT);
+    decimator_init(&g_decimator[1], DFT_CHANNEL_RIGHT);
+#else
+    decimator_init(&g_decimator[0], DFT_SAMPLE_CHANNEL);
+#endif
     // pre calculate the cosine twiddle factors, e.g. the n-th roots of unity
     for (int n = 0; n < DFT_N; ++n) {
         g_twiddle_factors[n] = cosf(n * PI2 / DFT_N);
     }
+    // Space the band edges geometrically between the first bin after DC and
+    // the end of the spectrum. The ratio is recalculated for every band, so
+    // that the bands that had to be widened to a whole bin don't shift the
+    // end of the last band.
+    g_band_edges[0] = 1;
+    for (int b = 0; b < DFT_BANDS_NUM; ++b) {
+        float ratio = powf((float)DFT_MAGNITUDE_SIZE / g_band_edges[b], 1.0f / (DFT_BANDS_NUM - b));
+        int edge = (int)roundf(g_band_edges[b] * ratio);
+        g_band_edges[b + 1] = (edge > g_band_edges[b]) ? edge : g_band_edges[b] + 1;
+    }
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_F32)
+    arm_rfft_fast_init_f32(&g_rfft_f32, DFT_N);
+#endif
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_Q15)
+    arm_rfft_init_q15(&g_rfft_q15, DFT_N, 0, 1);
+#endif
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_SLIDING)
+    for (int k = 0; k < SLIDING_BINS; ++k) {
+        g_sdft_rotation[2 * k] = DFT_SLIDING_DAMPING * cosf(k * DFT_2PI / DFT_N);
+        g_sdft_rotation[2 * k + 1] = DFT_SLIDING_DAMPING * sinf(k * DFT_2PI / DFT_N);
+    }
+    g_sdft_damping_n = powf(DFT_SLIDING_DAMPING, DFT_N);
+#endif
 }
 
 void dft_transform(int16_t *samples, uint32_t *magnitude) {
-    uint32_t p[DFT_PARTS_NUM][DFT_MAGNITUDE_SIZE];
+    dft_update(samples);
+    dft_get_magnitude(magnitude);
+}
+
+void dft_update(int16_t *samples) {
+    int16_t *fresh = gather(samples);
+#if (DFT_BACKEND == DFT_BACKEND_SLIDING)
+    sliding_update(fresh, DFT_BLOCK_SIZE);
+#else
+    (void)fresh;
+#endif
+}
+
+void dft_get_magnitude(uint32_t *magnitude) {
+#if (DFT_BACKEND == DFT_BACKEND_SLIDING)
+    sliding_read(magnitude);
+#else
+    analyze(transform_part, magnitude);
+#endif
+}
+
+void dft_map_bands(const uint32_t *magnitude, uint32_t *bands) {
+    for (int b = 0; b < DFT_BANDS_NUM; ++b) {
+        float sum = 0.0f;
+        for (int c = 0; c < DFT_CHANNELS_NUM; ++c) {
+            for (int k = g_band_edges[b]; k < g_band_edges[b + 1]; ++k) {
+                sum += magnitude[c * DFT_MAGNITUDE_SIZE + k];
+            }
+        }
+        // Level in steps of 0.1 dB relative to a full scale sine, shifted up
+        // by the range. Silence is clamped to the bottom.
+        sum = (sum > 1.0f) ? sum : 1.0f;
+        float level = 100.0f * log10f(sum / (DFT_CHANNELS_NUM * BAND_FULL_SCALE_POWER)) + DFT_BANDS_FULL_SCALE;
+        bands[b] = (level <= 0.0f) ? 0 : (level >= DFT_BANDS_FULL_SCALE) ? DFT_BANDS_FULL_SCALE : (uint32_t)level;
+    }
+}
+
+#ifdef DFT_BENCHMARK
+void dft_benchmark(uint32_t cycles[DFT_BACKEND_NUM]) {
+    static const struct {
+        const char *name;
+        transform_part_t part;
+    } backends[DFT_BACKEND_NUM] = {
+        [DFT_BACKEND_C] = {"C", transform_part_c},
+        [DFT_BACKEND_ASM] = {"ASM", transform_part_asm},
+        [DFT_BACKEND_FFT] = {"FFT", transform_part_fft},
+        [DFT_BACKEND_CMSIS_F32] = {"CMSIS_F32", transform_part_cmsis_f32},
+        [DFT_BACKEND_CMSIS_Q15] = {"CMSIS_Q15", transform_part_cmsis_q15},
+        [DFT_BACKEND_Q15] = {"Q15", transform_part_q15},
+        [DFT_BACKEND_SLIDING] = {"SLIDING", NULL},
+    };
+    // Synthetic block of two tones and some noise, similar to real music.
+    static int16_t samples[DFT_SAMPLE_SIZE];
+    for (int i = 0; i < DFT_SAMPLE_SIZE; ++i) {
+        samples[i] = 8000.0f * sinf(i * 0.05f) + 4000.0f * sinf(i * 0.31f) + (rand() % 2000 - 1000);
+    }
+    static uint32_t magnitude[DFT_MAGNITUDE_SIZE];
+    static uint32_t reference[DFT_MAGNITUDE_SIZE];
+    printf("dft benchmark with DFT_N = %u:\r\n", DFT_N);
+    for (int b = 0; b < DFT_BACKEND_NUM; ++b) {
+        uint32_t start = get_cycles();
+        for (int r = 0; r < DFT_BENCHMARK_RUNS; ++r) {
+            int16_t *fresh = gather(samples);
+            if (backends[b].part) {
+                analyze(backends[b].part, magnitude);
+            } else {
+                sliding_update(fresh, DFT_BLOCK_SIZE);
+                sliding_read(magnitude);
+            }
+        }
+        cycles[b] = (get_cycles() - start) / DFT_BENCHMARK_RUNS;
+        // Compare the last result against the C backend on the same samples,
+        // as parts per million of the peak. No printf() of floats needed.
+        analyze(transform_part_c, reference);
+        uint32_t peak = 1;
+        for (int k = 0; k < DFT_MAGNITUDE_SIZE; ++k) {
+            peak = (reference[k] > peak) ? reference[k] : peak;
+        }
+        float worst = 0.0f;
+        for (int k = 0; k < DFT_MAGNITUDE_SIZE; ++k) {
+            float error = fabsf((float)magnitude[k] - (float)reference[k]) / peak;
+            worst = (error > worst) ? error : worst;
+        }
+        printf("  %-9s: %lu cycles, max error %lu ppm of the peak\r\n", backends[b].name, (unsigned long)cycles[b],
+               (unsigned long)(worst * 1e6f));
+    }
+}
+#endif // DFT_BENCHMARK
+
+static inline int16_t *gather(int16_t *samples) {
+    // Lowpass filter and decimate the selected channel(s). If a single
+    // transform needs more samples than a block delivers, keep the previous
+    // samples and append the new ones at the end.
+    const int offset = DFT_BUFFER_SIZE - DFT_BLOCK_SIZE;
+    for (int c = 0; c < DFT_CHANNELS_NUM; ++c) {
+#if (DFT_BLOCK_SIZE < DFT_N)
+        memmove(g_samples[c], g_samples[c] + DFT_BLOCK_SIZE, offset * sizeof(int16_t));
+#endif
+        decimator_process(&g_decimator[c], samples, g_samples[c] + offset);
+    }
+    return g_samples[0] + offset;
+}
+
+static inline void analyze(transform_part_t part, uint32_t *magnitude) {
+#if (DFT_PARTS_NUM == 1)
+    // nothing to average, saves the buffer for the parts on the stack
+    part(g_samples[0], magnitude);
+#else
+    uint32_t p[DFT_PARTS_NUM][DFT_CHANNELS_NUM * DFT_MAGNITUDE_SIZE];
     // run algorithm in batches
     for (int i = 0; i < DFT_PARTS_NUM; ++i) {
-        transform_part(samples + i * DFT_PARTS_LENGTH, p[i]);
+        part(g_samples[0] + i * DFT_N, p[i]);
     }
     // calculate average of magnitudes
-    for (int j = 0; j < DFT_MAGNITUDE_SIZE; ++j) {
+    for (int j = 0; j < DFT_CHANNELS_NUM * DFT_MAGNITUDE_SIZE; ++j) {
         uint64_t average = 0;
         for (int i = 0; i < DFT_PARTS_NUM; ++i) {
             average += p[i][j];
         }
         magnitude[j] = average / DFT_PARTS_NUM;
     }
+#endif
+}
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_FFT)
+#if (DFT_CHANNELS_NUM == 1)
+static void transform_part_fft(int16_t *samples, uint32_t *magnitude) {
+    // Load the windowed real samples directly into their bit reversed position.
+    for (int n = 0; n < DFT_N; ++n) {
+        float *x = &g_fft[2 * g_fft_bitrev[n]];
+        x[0] = samples[n] * WINDOW_F32(n);
+        x[1] = 0.0f;
+    }
+    fft_run();
+    // The input was real, so the upper half of the spectrum is just the
+    // complex conjugate of the lower half and can be ignored.
+    for (int k = 0; k < DFT_N / 2; ++k) {
+        float Xre = g_fft[2 * k];
+        float Xim = g_fft[2 * k + 1];
+        magnitude[k] = clamp_magnitude(Xre * Xre + Xim * Xim);
+    }
+}
+#else
+static void transform_part_fft_stereo(int16_t *samples, uint32_t *magnitude) {
+    const int16_t *left = samples;
+    const int16_t *right = samples + DFT_BUFFER_SIZE;
+    for (int n = 0; n < DFT_N; ++n) {
+        float *x = &g_fft[2 * g_fft_bitrev[n]];
+        float w = WINDOW_F32(n);
+        x[0] = left[n] * w;
+        x[1] = right[n] * w;
+    }
+    fft_run();
+    for (int k = 0; k < DFT_N / 2; ++k) {
+        // With Z = FFT(L + jR): L[k] = (Z[k] + Z*[N - k]) / 2 and
+        // R[k] = (Z[k] - Z*[N - k]) / 2j. The 1/2 is left out and instead
+        // accounted for in the magnitudes.
+        const float *Zk = &g_fft[2 * k];
+        const float *Zm = &g_fft[2 * ((DFT_N - k) & (DFT_N - 1))];
+        float Lre = Zk[0] + Zm[0];
+        float Lim = Zk[1] - Zm[1];
+        float Rre = Zk[1] + Zm[1];
+        float Rim = Zm[0] - Zk[0];
+#if (DFT_STEREO_MODE == DFT_STEREO_MS)
+        // mid and side are just linear combinations of the spectra
+        float Mre = (Lre + Rre) * 0.5f;
+        float Mim = (Lim + Rim) * 0.5f;
+        Rre = (Lre - Rre) * 0.5f;
+        Rim = (Lim - Rim) * 0.5f;
+        Lre = Mre;
+        Lim = Mim;
+#endif
+        magnitude[k] = clamp_magnitude((Lre * Lre + Lim * Lim) * 0.25f);
+        magnitude[DFT_MAGNITUDE_SIZE + k] = clamp_magnitude((Rre * Rre + Rim * Rim) * 0.25f);
+    }
 }
+#endif
 
-#ifndef DFT_USE_ASM
-static void transform_part(int16_t *samples, uint32_t *magnitude) {
+static void fft_run(void) {
+    // Combine two transforms of length half into one of length size. The
+    // twiddle factor for index j in a stage of length size is W^(j * N / size).
+    int step = DFT_N / 2;
+    for (int size = 2; size <= DFT_N; size *= 2, step /= 2) {
+        int half = size / 2;
+        for (int j = 0; j < half; ++j) {
+            float Wre = g_fft_cos[j * step];
+            float Wim = -g_fft_sin[j * step];
+            for (int a = j; a < DFT_N; a += size) {
+                float *x = &g_fft[2 * a];
+                float *y = &g_fft[2 * (a + half)];
+                float Tre = Wre * y[0] - Wim * y[1];
+                float Tim = Wre * y[1] + Wim * y[0];
+                y[0] = x[0] - Tre;
+                y[1] = x[1] - Tim;
+                x[0] += Tre;
+                x[1] += Tim;
+            }
+        }
+    }
+}
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_C)
+static void transform_part_c(int16_t *samples, uint32_t *magnitude) {
     for (int k = 0; k < DFT_N / 2; ++k) {
         int a = 0;
         int b = DFT_SIN_OFFSET;
         float Xre = 0.0f;
         float Xim = 0.0f;
         for (int n = 0; n < DFT_N; ++n) {
-            int32_t s = samples[DFT_SAMPLE_CHANNEL + 2 * n * DFT_UNDER_SAMPLING];
+            float s = samples[n] * WINDOW_F32(n);
             Xre += s * g_twiddle_factors[a % DFT_N];
             Xim -= s * g_twiddle_factors[b % DFT_N];
             a += k;
             b += k;
         }
         float P = Xre * Xre + Xim * Xim;
-        magnitude[k] = P;
+        magnitude[k] = clamp_magnitude(P);
+    }
+}
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_F32)
+static void transform_part_cmsis_f32(int16_t *samples, uint32_t *magnitude) {
+    for (int n = 0; n < DFT_N; ++n) {
+        g_rfft_f32_in[n] = samples[n] * WINDOW_F32(n);
+    }
+    arm_rfft_fast_f32(&g_rfft_f32, g_rfft_f32_in, g_rfft_f32_out, 0);
+    // The output is packed: [0] is the real DC value, [1] is the real value at
+    // the nyquist frequency (not needed) and after that follow the interleaved
+    // real and imaginary parts of the bins 1 up to N/2 - 1.
+    magnitude[0] = clamp_magnitude(g_rfft_f32_out[0] * g_rfft_f32_out[0]);
+    for (int k = 1; k < DFT_N / 2; ++k) {
+        float Xre = g_rfft_f32_out[2 * k];
+        float Xim = g_rfft_f32_out[2 * k + 1];
+        magnitude[k] = clamp_magnitude(Xre * Xre + Xim * Xim);
     }
 }
 #endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_CMSIS_Q15)
+static void transform_part_cmsis_q15(int16_t *samples, uint32_t *magnitude) {
+#if (DFT_WINDOW == DFT_WINDOW_RECTANGULAR)
+    memcpy(g_rfft_q15_in, samples, sizeof(g_rfft_q15_in));
+#else
+    for (int n = 0; n < DFT_N; ++n) {
+        g_rfft_q15_in[n] = window_q15(samples, n);
+    }
+#endif
+    arm_rfft_q15(&g_rfft_q15, g_rfft_q15_in, g_rfft_q15_out);
+    // To not saturate, CMSIS scales the input down by two in every stage. So
+    // the output has to be scaled up by log2(N) bits to be comparable with the
+    // other backends. As magnitudes are squared, they are scaled by twice that.
+    const int upscale = 2 * __builtin_ctz(DFT_N);
+    for (int k = 0; k < DFT_N / 2; ++k) {
+        int32_t Xre = g_rfft_q15_out[2 * k];
+        int32_t Xim = g_rfft_q15_out[2 * k + 1];
+        uint64_t P = (uint64_t)((uint32_t)(Xre * Xre) + (uint32_t)(Xim * Xim)) << upscale;
+        magnitude[k] = clamp_magnitude((float)P);
+    }
+}
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_Q15)
+static void transform_part_q15(int16_t *samples, uint32_t *magnitude) {
+    // Same algorithm as transform_part_c() but in fixed point. Two consecutive
+    // samples are loaded at once as packed halfwords and multiplied with two
+    // packed twiddle factors by a single SMLALD instruction. The products are
+    // Q15 and the 64 bit accumulator can't overflow, so no saturation needed.
+#if (DFT_WINDOW != DFT_WINDOW_RECTANGULAR)
+    // The samples are needed N / 2 times, so window them once up front.
+    for (int n = 0; n < DFT_N; ++n) {
+        g_q15_windowed[n] = window_q15(samples, n);
+    }
+    samples = g_q15_windowed;
+#endif
+    for (int k = 0; k < DFT_N / 2; ++k) {
+        int a = 0;
+        int b = DFT_SIN_OFFSET;
+        int64_t Xre = 0;
+        int64_t Xim = 0;
+        for (int n = 0; n < DFT_N / 2; ++n) {
+            uint32_t s = read_q15x2(samples + 2 * n);
+            int a2 = (a + k) & (DFT_N - 1);
+            int b2 = (b + k) & (DFT_N - 1);
+            uint32_t wcos = __PKHBT(g_twiddle_factors_q15[a], g_twiddle_factors_q15[a2], 16);
+            uint32_t wsin = __PKHBT(g_twiddle_factors_q15[b], g_twiddle_factors_q15[b2], 16);
+            Xre = __SMLALD(s, wcos, Xre);
+            Xim = __SMLALD(s, wsin, Xim);
+            a = (a + 2 * k) & (DFT_N - 1);
+            b = (b + 2 * k) & (DFT_N - 1);
+        }
+        // convert from Q15 back to the scale of the samples (with rounding)
+        Xre = (Xre + (1 << 14)) >> 15;
+        Xim = (Xim + (1 << 14)) >> 15;
+        uint64_t P = Xre * Xre + Xim * Xim;
+        magnitude[k] = clamp_magnitude((float)P);
+    }
+}
+#endif
+
+#if DFT_BACKEND_ENABLED(DFT_BACKEND_SLIDING)
+static void sliding_update(const int16_t *samples, int count) {
+    for (int n = 0; n < count; ++n) {
+        // The change of the window is the same for all bins.
+        float x = samples[n] - g_sdft_damping_n * g_sdft_history[g_sdft_oldest];
+        g_sdft_history[g_sdft_oldest] = samples[n];
+        g_sdft_oldest = (g_sdft_oldest + 1) % DFT_N;
+        for (int k = 0; k < SLIDING_BINS; ++k) {
+            float Sre = g_sdft[2 * k];
+            float Sim = g_sdft[2 * k + 1];
+            float Wre = g_sdft_rotation[2 * k];
+            float Wim = g_sdft_rotation[2 * k + 1];
+            g_sdft[2 * k] = x + Wre * Sre - Wim * Sim;
+            g_sdft[2 * k + 1] = Wre * Sim + Wim * Sre;
+        }
+    }
+}
+
+static void sliding_read(uint32_t *magnitude) {
+#if (DFT_WINDOW == DFT_WINDOW_RECTANGULAR)
+    for (int k = 0; k < DFT_MAGNITUDE_SIZE; ++k) {
+        float Sre = g_sdft[2 * k];
+        float Sim = g_sdft[2 * k + 1];
+        magnitude[k] = clamp_magnitude(Sre * Sre + Sim * Sim);
+    }
+#else
+    // The running bin k is the dft bin X[k] rotated by e^(-j * 2 * pi * k / N)
+    // (and scaled by r). As the window combines neighbouring bins, their phase
+    // has to be right, so undo the rotation. The scale is the same for all.
+    float *X = g_sdft_spectrum;
+    for (int k = 0; k < SLIDING_BINS; ++k) {
+        float Sre = g_sdft[2 * k];
+        float Sim = g_sdft[2 * k + 1];
+        float Wre = g_sdft_rotation[2 * k];
+        float Wim = g_sdft_rotation[2 * k + 1];
+        X[2 * k] = Wre * Sre - Wim * Sim;
+        X[2 * k + 1] = Wre * Sim + Wim * Sre;
+    }
+    // A cosine sum window in the time domain is a convolution with a few bins
+    // in the frequency domain: Xw[k] = a0 * X[k] - a1 / 2 * (X[k - 1] +
+    // X[k + 1]) + a2 / 2 * (X[k - 2] + X[k + 2]) - ...
+    for (int k = 0; k < DFT_MAGNITUDE_SIZE; ++k) {
+        float Xre = g_window_terms[0] * X[2 * k];
+        float Xim = g_window_terms[0] * X[2 * k + 1];
+        for (int i = 1; i < WINDOW_TERMS; ++i) {
+            // Bins outside of 0 up to N / 2 are the complex conjugate of the
+            // mirrored bins, as the samples are real.
+            int lo = k - i;
+            int hi = k + i;
+            float lo_im = (lo < 0) ? -X[2 * -lo + 1] : X[2 * lo + 1];
+            float lo_re = (lo < 0) ? X[2 * -lo] : X[2 * lo];
+            float hi_im = (hi > DFT_N / 2) ? -X[2 * (DFT_N - hi) + 1] : X[2 * hi + 1];
+            float hi_re = (hi > DFT_N / 2) ? X[2 * (DFT_N - hi)] : X[2 * hi];
+            Xre += g_window_terms[i] * (lo_re + hi_re);
+            Xim += g_window_terms[i] * (lo_im + hi_im);
+        }
+        magnitude[k] = clamp_magnitude(Xre * Xre + Xim * Xim);
+    }
+#endif
+}
+#endif
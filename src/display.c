@@ -41,8 +41,10 @@
 
 #include <lcd.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "display.h"
+#include "player.h"
 #include "utils.h"
 
 // Sizes of elements and units
@@ -98,13 +100,31 @@ static enum {
     DISPLAY_SONG
 } g_state;
 
-static const song_t *g_current_list; //!< pointer to the current song list
-static size_t g_list_length;         //!< length of the list
-static size_t g_list_selection;      //!< currently selected song in list
+static display_list_callback g_list;                    //!< loads pages of the song list
+static size_t g_list_length;                            //!< length of the list
+static size_t g_list_selection;                         //!< currently selected song in list
+static song_info_t g_list_page[DISPLAY_LIST_PAGE_SIZE]; //!< songs of the shown page
+static size_t g_list_page_first;                        //!< position of the first song of the page
+static size_t g_list_page_length;                       //!< count of songs of the page, 0 if not loaded
 
 static const song_t *g_current_song; //!< pointer to the currently playing song
 static uint16_t g_spectogram[DISPLAY_NUM_OF_SPECTOGRAM_BARS];
 
+static display_clock_callback g_clock; //!< time source for queued spectograms
+
+/**
+ * @brief Spectograms that wait until they are due.
+ * 
+ * Ring buffer, head and tail are counts of the queued respectively the shown
+ * or dropped entries.
+ */
+static struct {
+    uint32_t timestamp[DISPLAY_SPECTOGRAM_QUEUE_DEPTH];
+    uint16_t bars[DISPLAY_SPECTOGRAM_QUEUE_DEPTH][DISPLAY_NUM_OF_SPECTOGRAM_BARS];
+    uint32_t head;
+    uint32_t tail;
+} g_spectogram_queue;
+
 /**
  * @brief Flags for the main display loop.
  * 
@@ -129,18 +149,45 @@ static void update_callback(void);
  */
 static void update_song_list(void);
 
+/**
+ * @brief Load the page of the list with the selected song.
+ * 
+ * Does nothing if it is loaded already. The page is read while holding back
+ * the refill of the player, see \ref player_lock().
+ * 
+ * @retval 0 on success
+ * @retval -1 on failure (page could not be loaded)
+ */
+static int load_list_page(void);
+
 /**
  * @brief Initialize spectogram.
  * 
  */
 static void init_spectogram(void);
 
+/**
+ * @brief Take the newest due spectogram from the queue.
+ * 
+ */
+static void dequeue_spectogram(void);
+
 /**
  * @brief Draw the spectogram bars.
  * 
  */
 static void update_spectogram(void);
 
+/**
+ * @brief Convert spectogram data to bar heights in pixel.
+ * 
+ * @param[in] spectogram data in the range 0 to \par max_value
+ * @param max_value upper limit of data
+ * @param[out] bars top y coordinate of each bar
+ */
+static void convert_spectogram(const uint32_t spectogram[DISPLAY_NUM_OF_SPECTOGRAM_BARS], uint32_t max_value,
+                               uint16_t bars[DISPLAY_NUM_OF_SPECTOGRAM_BARS]);
+
 /**
  * @brief Draw album cover and song meta information once.
  * 
@@ -153,6 +200,34 @@ static void init_play_stats(void);
  */
 static void update_play_stats(void);
 
+/**
+ * @brief Draw the album cover from its BMP file.
+ * 
+ * Supports uncompressed BMP files with 16, 24 or 32 bits per pixel of up to
+ * ALBUM_COVER pixels in width and height, stored bottom up or top down. The
+ * file is read row by row, each read holds back the refill of the player only
+ * shortly, see \ref player_lock().
+ * 
+ * @param filename name of the BMP file
+ * @param x left position of the cover
+ * @param y top position of the cover
+ * @retval 0 on success
+ * @retval -1 on failure (file not found or not supported)
+ */
+static int draw_album_cover(const char *filename, uint16_t x, uint16_t y);
+
+/**
+ * @brief Read from a file while holding back refills of the player.
+ * 
+ * @param file file to read from
+ * @param offset position in the file to read from
+ * @param[out] buffer buffer to read into
+ * @param length count of bytes to read
+ * @retval 0 on success
+ * @retval -1 on failure (not all bytes could be read)
+ */
+static int read_locked(FIL *file, uint32_t offset, void *buffer, size_t length);
+
 int display_init(void) {
     // check current state
     if (g_state != DISPLAY_NOT_INITIALIZED) {
@@ -203,6 +278,7 @@ int display_loop(void) {
         break;
     case (DISPLAY_SONG):
         // update spectogram
+        dequeue_spectogram();
         update_spectogram();
         // update play stats
         update_play_stats();
@@ -211,18 +287,22 @@ int display_loop(void) {
     return 0;
 }
 
-int display_set_list(const song_t songs[], size_t length) {
-    if (g_state == DISPLAY_NOT_INITIALIZED) {
+int display_set_list(size_t length, display_list_callback list) {
+    if (g_state == DISPLAY_NOT_INITIALIZED || !list) {
         return -1;
     }
-    g_current_list = songs;
+    g_list = list;
     g_list_length = length;
+    if (g_list_selection >= length) {
+        g_list_selection = 0;
+    }
+    g_list_page_length = 0; // the list may have changed, load again
     g_state = DISPLAY_INIT_LIST;
     return 0;
 }
 
 int display_move_selection(int direction) {
-    if (g_state != DISPLAY_LIST) {
+    if ((g_state != DISPLAY_LIST && g_state != DISPLAY_INIT_LIST) || !g_list_length) {
         return -1;
     }
     // Move the current selection index up or down. If it goes out of bounds do
@@ -242,14 +322,34 @@ int display_move_selection(int direction) {
             ++g_list_selection;
         }
     }
+    if (g_list_selection / DISPLAY_LIST_PAGE_SIZE != g_list_page_first / DISPLAY_LIST_PAGE_SIZE) {
+        // moved to another page, clear the screen and draw it anew
+        g_state = DISPLAY_INIT_LIST;
+    }
+    return 0;
+}
+
+int display_set_selection(size_t position) {
+    if ((g_state != DISPLAY_LIST && g_state != DISPLAY_INIT_LIST) || position >= g_list_length) {
+        return -1;
+    }
+    g_list_selection = position;
+    if (g_list_selection / DISPLAY_LIST_PAGE_SIZE != g_list_page_first / DISPLAY_LIST_PAGE_SIZE) {
+        // jumped to another page, clear the screen and draw it anew
+        g_state = DISPLAY_INIT_LIST;
+    }
     return 0;
 }
 
-int display_get_selection(song_t **song) {
-    if (g_state != DISPLAY_LIST) {
+int display_get_selection(song_info_t *song, size_t *position) {
+    if (g_state != DISPLAY_LIST && g_state != DISPLAY_INIT_LIST) {
         return -1;
     }
-    *song = (song_t *)&g_current_list[g_list_selection];
+    if (load_list_page() || g_list_selection - g_list_page_first >= g_list_page_length) {
+        return -1;
+    }
+    *song = g_list_page[g_list_selection - g_list_page_first];
+    *position = g_list_selection;
     return 0;
 }
 
@@ -258,6 +358,7 @@ int display_set_song(const song_t *song) {
         return -1;
     }
     g_current_song = song;
+    g_spectogram_queue.tail = g_spectogram_queue.head; // drop spectograms of previous song
     g_state = DISPLAY_INIT_SONG;
     return 0;
 }
@@ -266,42 +367,107 @@ int display_set_spectogram(uint32_t spectogram[DISPLAY_NUM_OF_SPECTOGRAM_BARS],
     if (g_state != DISPLAY_SONG && g_state != DISPLAY_INIT_SONG) {
         return -1;
     }
-    // Convert the input value from the range [0 to max_value] to
-    // [SPECTOGRAM_HEIGHT to 0]. This inversion (max value in input is min value
-    // in output) is necessary because the pixels on the LCD are counted from
-    // the top down.
-    for (int i = 0; i < DISPLAY_NUM_OF_SPECTOGRAM_BARS; ++i) {
-        g_spectogram[i] = map_value_u(spectogram[i], 0, max_value,
-                                      SPECTOGRAM_HEIGHT, SPECTOGRAM_START_Y);
-    }
+    convert_spectogram(spectogram, max_value, g_spectogram);
     g_flags.spectogram_updated = 1;
     return 0;
 }
 
+int display_queue_spectogram(uint32_t spectogram[DISPLAY_NUM_OF_SPECTOGRAM_BARS], uint32_t max_value, uint32_t timestamp) {
+    if (!g_clock) {
+        return display_set_spectogram(spectogram, max_value);
+    }
+    if (g_state != DISPLAY_SONG && g_state != DISPLAY_INIT_SONG) {
+        return -1;
+    }
+    uint32_t head = g_spectogram_queue.head;
+    if (head - g_spectogram_queue.tail >= DISPLAY_SPECTOGRAM_QUEUE_DEPTH) {
+        // full, the oldest will never be shown anyway
+        g_spectogram_queue.tail++;
+    }
+    uint32_t i = head % DISPLAY_SPECTOGRAM_QUEUE_DEPTH;
+    g_spectogram_queue.timestamp[i] = timestamp;
+    convert_spectogram(spectogram, max_value, g_spectogram_queue.bars[i]);
+    g_spectogram_queue.head = head + 1;
+    return 0;
+}
+
+int display_set_clock(display_clock_callback clock) {
+    if (!clock) {
+        return -1;
+    }
+    g_clock = clock;
+    return 0;
+}
+
 static void update_callback(void) {
     g_flags.update_done = 1;
 }
 
 static void update_song_list(void) {
+    if (load_list_page()) {
+        return;
+    }
     LCD_SetFont(LIST_FONT);
-    for (int i = 0; i < g_list_length; ++i) {
+    for (int i = 0; i < g_list_page_length; ++i) {
         // invert the colors for the currently selected list entry
-        LCD_SetTextColor(i == g_list_selection ? GUI_COLOR_BLACK : GUI_COLOR_WHITE);
-        LCD_SetBackColor(i == g_list_selection ? GUI_COLOR_WHITE : GUI_COLOR_BLACK);
+        int selected = (g_list_page_first + i == g_list_selection);
+        LCD_SetTextColor(selected ? GUI_COLOR_BLACK : GUI_COLOR_WHITE);
+        LCD_SetBackColor(selected ? GUI_COLOR_WHITE : GUI_COLOR_BLACK);
         char tmp[(SONGS_MAX_STRING_LENGTH * 2) + 3]; // "artist" + " - " + "title"
-        snprintf(tmp, sizeof(tmp), "%s - %s", g_current_list[i].artist, g_current_list[i].name);
+        snprintf(tmp, sizeof(tmp), "%s - %s", g_list_page[i].artist, g_list_page[i].name);
         LCD_DisplayStringLine(i, tmp);
     }
     LCD_SetTextColor(GUI_COLOR_WHITE);
     LCD_SetBackColor(GUI_COLOR_BLACK);
 }
 
+static int load_list_page(void) {
+    size_t first = g_list_selection - g_list_selection % DISPLAY_LIST_PAGE_SIZE;
+    if (g_list_page_length && first == g_list_page_first) {
+        return 0;
+    }
+    if (first >= g_list_length) {
+        // empty list
+        return -1;
+    }
+    size_t length = DISPLAY_LIST_PAGE_SIZE;
+    player_lock();
+    int ret = g_list(first, g_list_page, &length);
+    player_unlock();
+    g_list_page_first = first;
+    g_list_page_length = ret ? 0 : length;
+    return ret;
+}
+
 static void init_spectogram(void) {
     for (int i = 0; i < DISPLAY_NUM_OF_SPECTOGRAM_BARS; ++i) {
         g_spectogram[i] = 0;
     }
 }
 
+static void dequeue_spectogram(void) {
+    if (!g_clock) {
+        return;
+    }
+    uint32_t now = g_clock();
+    // Timestamps are compared by their difference so that a wrap around of the
+    // clock does no harm. Take the newest entry that is due, older due entries
+    // are already outdated.
+    int due = -1;
+    while (g_spectogram_queue.tail != g_spectogram_queue.head) {
+        uint32_t i = g_spectogram_queue.tail % DISPLAY_SPECTOGRAM_QUEUE_DEPTH;
+        if ((int32_t)(now - g_spectogram_queue.timestamp[i]) < 0) {
+            break;
+        }
+        due = i;
+        g_spectogram_queue.tail++;
+    }
+    if (due >= 0) {
+        memcpy(g_spectogram, g_spectogram_queue.bars[due], sizeof(g_spectogram));
+        g_flags.spectogram_updated = 1;
+    }
+}
+
 static void update_spectogram(void) {
     if (g_flags.spectogram_updated) {
         g_flags.spectogram_updated = 0;
@@ -321,17 +487,29 @@ static void update_spectogram(void) {
     }
 }
 
+static void convert_spectogram(const uint32_t spectogram[DISPLAY_NUM_OF_SPECTOGRAM_BARS], uint32_t max_value,
+                               uint16_t bars[DISPLAY_NUM_OF_SPECTOGRAM_BARS]) {
+    // Convert the input value from the range [0 to max_value] to
+    // [SPECTOGRAM_HEIGHT to 0]. This inversion (max value in input is min value
+    // in output) is necessary because the pixels on the LCD are counted from
+    // the top down.
+    for (int i = 0; i < DISPLAY_NUM_OF_SPECTOGRAM_BARS; ++i) {
+        bars[i] = map_value_u(spectogram[i], 0, max_value,
+                              SPECTOGRAM_HEIGHT, SPECTOGRAM_START_Y);
+    }
+}
+
 static void init_play_stats(void) {
     // album cover
-    LCD_BMP_DrawBitmap(g_current_song->bmp_name, 0, SPECTOGRAM_END_Y);
+    draw_album_cover(g_current_song->info.bmp_name, 0, SPECTOGRAM_END_Y);
     // song name and artist
     LCD_SetFont(NAME_FONT);
-    LCD_DisplayStringXY(NAME_START_X, NAME_START_Y, g_current_song->name);
+    LCD_DisplayStringXY(NAME_START_X, NAME_START_Y, g_current_song->info.name);
     LCD_SetFont(ARTIST_FONT);
-    LCD_DisplayStringXY(ARTIST_START_X, ARTIST_START_Y, g_current_song->artist);
+    LCD_DisplayStringXY(ARTIST_START_X, ARTIST_START_Y, g_current_song->info.artist);
     // playing time
     char tmp[14];
-    int secs = SONGS_SAMPLES_TO_SECONDS(g_current_song->samples);
+    int secs = SONGS_SAMPLES_TO_SECONDS(g_current_song->info.samples);
     int mins = secs / 60;
     secs -= mins * 60;
     snprintf(tmp, sizeof(tmp), "00:00 / %02d:%02d", mins, secs);
@@ -343,7 +521,7 @@ static void update_play_stats(void) {
     // progress bar
     static int last_bar_end;
     uint16_t bar_end_x =
-        map_value_u(g_current_song->samples_read, 0, g_current_song->samples, PROGRESS_START_X, PROGRESS_END_X);
+        map_value_u(g_current_song->samples_read, 0, g_current_song->info.samples, PROGRESS_START_X, PROGRESS_END_X);
     if (bar_end_x != last_bar_end) {
         last_bar_end = bar_end_x;
         LCD_FillArea(PROGRESS_START_X, PROGRESS_START_Y, bar_end_x, PROGRESS_END_Y, GUI_COLOR_WHITE);
@@ -361,3 +539,69 @@ static void update_play_stats(void) {
         LCD_DisplayStringXY(PLAY_TIME_START_X, PLAY_TIME_START_Y, tmp);
     }
 }
+
+static int draw_album_cover(const char *filename, uint16_t x, uint16_t y) {
+    // The LCD library has LCD_BMP_DrawBitmap(), but it reads pixel by pixel
+    // and the file system can't be locked in between. Parse only the fields of
+    // the header that are needed, all little endian.
+    FIL file;
+    player_lock();
+    int err = f_open(&file, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK;
+    player_unlock();
+    if (err) {
+        return -1;
+    }
+    uint8_t header[34];
+    uint32_t offset = 0, width = 0, rows = 0;
+    int32_t height = 0;
+    uint16_t bpp = 0;
+    err = read_locked(&file, 0, header, sizeof(header));
+    if (!err) {
+        offset = header[10] | header[11] << 8 | header[12] << 16 | (uint32_t)header[13] << 24;
+        uint32_t header_size = header[14] | header[15] << 8 | header[16] << 16 | (uint32_t)header[17] << 24;
+        width = header[18] | header[19] << 8 | header[20] << 16 | (uint32_t)header[21] << 24;
+        height = (int32_t)(header[22] | header[23] << 8 | header[24] << 16 | (uint32_t)header[25] << 24);
+        bpp = header[28] | header[29] << 8;
+        uint32_t compression = header[30] | header[31] << 8 | header[32] << 16 | (uint32_t)header[33] << 24;
+        // a negative height marks rows that are stored from the top down
+        rows = (height < 0) ? -(uint32_t)height : (uint32_t)height;
+        // Only uncompressed bitmaps with at least a BITMAPINFOHEADER, that fit
+        // into the area of the cover.
+        err = header[0] != 'B' || header[1] != 'M' || header_size < 40 || compression != 0 || !width ||
+              width > ALBUM_COVER || !rows || rows > ALBUM_COVER || (bpp != 16 && bpp != 24 && bpp != 32);
+    }
+    // Rows are stored from the bottom up, unless the height is negative, and
+    // padded to a multiple of 4 bytes.
+    uint8_t row[ALBUM_COVER * 4];
+    uint32_t row_size = (width * (bpp / 8) + 3) & ~3U;
+    for (uint32_t r = 0; !err && r < rows; ++r) {
+        err = read_locked(&file, offset + r * row_size, row, width * (bpp / 8));
+        uint16_t line = y + ((height < 0) ? r : rows - 1 - r);
+        for (uint32_t c = 0; !err && c < width; ++c) {
+            uint8_t *pixel = row + c * (bpp / 8);
+            uint16_t color;
+            if (bpp == 16) {
+                // already in the RGB 5-6-5 format, stored as a little endian word
+                color = pixel[0] | pixel[1] << 8;
+            } else {
+                // convert from BGR to the RGB 5-6-5 format
+                color = ((pixel[0] >> 3) & 0x001F) | ((pixel[1] << 3) & 0x07E0) | ((pixel[2] << 8) & 0xF800);
+            }
+            LCD_WritePixel(x + c, line, color);
+        }
+    }
+    player_lock();
+    f_close(&file);
+    player_unlock();
+    return err ? -1 : 0;
+}
+
+static int read_locked(FIL *file, uint32_t offset, void *buffer, size_t length) {
+    UINT read = 0;
+    player_lock();
+    if (f_lseek(file, offset) == FR_OK) {
+        f_read(file, buffer, length, &read);
+    }
+    player_unlock();
+    return read != length ? -1 : 0;
+}
@@ -2,21 +2,49 @@
 #include <carme.h>
 #include <carme_io1.h>
 #include <carme_io2.h>
+#include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "utils.h"
 #include "songs.h"
 #include "player.h"
 #include "display.h"
 #include "dft.h"
+#include "analyzer.h"
+#include "mixer.h"
 
-#define MAX_SONGS 10                   //!< define how many songs can be loaded
-static song_t songs[MAX_SONGS];        //!< array of possibly available songs
-static size_t songs_count = MAX_SONGS; //!< count of really available songs
+#ifdef DFT_BENCHMARK
+#include <uart.h>
+#endif
+
+#if (DFT_BANDS_NUM != DISPLAY_NUM_OF_SPECTOGRAM_BARS)
+#error "Every spectogram bar needs exactly one band of the dft."
+#endif
+
+static size_t songs_count;             //!< count of songs in the library
+static song_t opened_songs[2];         //!< the playing song and the one that follows it
 static song_t *selected_song;          //!< currently playing song
+static song_t *queued_song;            //!< song that follows the playing one
+static size_t selected_nr;             //!< position of the playing song in the library
+static uint8_t playing;                //!< play was pressed and stop not yet
+static __IO uint8_t song_changed;      //!< set by the refill when the queued song took over
+static uint32_t fade_position;         //!< samples of the crossfade that were mixed
+static uint32_t fade_duration;         //!< samples the running crossfade takes, 0 if none
+
+#define SKIP_SAMPLES (10U * 2U * 48000U)  //!< how far the skip buttons jump, 10 s
+#define QUEUE_SAMPLES (5U * 2U * 48000U) //!< how long before the end the next song is queued, 5 s
+#ifndef CROSSFADE_SAMPLES
+#define CROSSFADE_SAMPLES (0U * 2U * 48000U) //!< how long the songs of the list overlap, 0 s plays them without a gap
+#endif
+#define JUMP_HOLD_TICKS (5U) //!< how many inputs a move button is held before the list jumps by initial, 500 ms
+
+#if (CROSSFADE_SAMPLES >= QUEUE_SAMPLES)
+#error "The next song has to be queued before the crossfade starts."
+#endif
 
 /**
- * @brief Load the next chunk of audio data and run dft.
+ * @brief Load the next chunk of audio data and queue it for the dft.
  * 
  * @param[in,out] data pointer to a buffer of size PLAYER_BUFFER_SIZE
  * @param[out] length size of valid buffer data, \ref PLAYER_BUFFER_SIZE or less
@@ -25,6 +53,59 @@ static song_t *selected_song;          //!< currently playing song
  */
 int load_audio_data(int16_t *data, size_t *length);
 
+#if (CROSSFADE_SAMPLES > 0)
+/**
+ * @brief Mix the start of the queued song into a chunk of the playing song.
+ * 
+ * Starts the crossfade once less than CROSSFADE_SAMPLES of the playing song
+ * are left and switches to the queued song when the playing one ended.
+ * 
+ * @param[in,out] data chunk that was read of the playing song
+ * @param[in,out] length valid samples of the chunk
+ * @param requested samples the chunk can hold
+ * @retval 0 on success
+ * @retval -1 when the queued song could not be read
+ */
+int crossfade_audio_data(int16_t *data, size_t *length, size_t requested);
+#endif
+
+/**
+ * @brief Run dft over a chunk of audio data and display the spectogram.
+ * 
+ * @param[in] data pointer to a buffer of size PLAYER_BUFFER_SIZE
+ * @param timestamp playback position of the chunk
+ * @param latest 0 if a newer chunk is queued, the spectogram is not needed
+ */
+void analyze_audio_data(int16_t *data, uint32_t timestamp, int latest);
+
+/**
+ * @brief Queue the next song of the list shortly before the playing one ends.
+ * 
+ * The songs of the list play one after another without a gap or crossfaded
+ * over CROSSFADE_SAMPLES, the last one stops the player.
+ */
+void queue_next_song(void);
+
+/**
+ * @brief Drop a running crossfade after the playing song was skipped.
+ * 
+ * The queued song starts over, the crossfade begins anew when the playing song
+ * gets close to its end again.
+ */
+void restart_crossfade(void);
+
+/**
+ * @brief Move the selection of the list to another initial of the artists.
+ * 
+ * The list is sorted by artist, the songs of an initial follow each other.
+ * Down jumps to the first song of the next initial, up to the first song of
+ * the initial or of the one before if it is selected already. Every jump is a
+ * binary search of the library.
+ * 
+ * @param direction 0 = move down in the list, 1 = move up in the list
+ */
+void jump_to_letter(int direction);
+
 /**
  * @brief Check for new button presses or potentiometer changes.
  * 
@@ -43,17 +124,39 @@ int main(void) {
     CARME_IO2_Init(); // used for potentiometer
 
     // initialize submodules
-    utils_init();                          // starts SysTick timer
-    songs_init();                          // mounts SD-card filesystem
-    songs_list_songs(songs, &songs_count); // loads available songs from SD-card
-    player_init(load_audio_data);          // starts audio hardware and DMA
-    display_init();                        // starts lcd hardware
-    display_set_list(songs, songs_count);  // give display the available songs
-    dft_init();                            // precalculate twiddle factors
+    utils_init();                                    // starts SysTick timer
+    songs_init();                                    // mounts SD-card filesystem
+    songs_scan_songs(&songs_count);                  // updates the library of songs on the SD-card
+    player_init(load_audio_data);                    // starts audio hardware and DMA
+    display_init();                                  // starts lcd hardware
+    display_set_list(songs_count, songs_list_songs); // display loads the library page by page
+    display_set_clock(player_get_position);          // show spectogram in sync to playback
+    dft_init();                                      // precalculate twiddle factors
+    analyzer_init(analyze_audio_data);               // runs the dft on played audio
+
+#ifdef DFT_BENCHMARK
+    // Print cycles per dft_transform() and the deviation from the C backend of
+    // every backend over UART0 (115200 8N1).
+    USART_InitTypeDef USART_config;
+    USART_StructInit(&USART_config);
+    USART_config.USART_BaudRate = 115200;
+    CARME_UART_GPIO_Init();
+    CARME_UART_Init(CARME_UART0, &USART_config);
+    uint32_t cycles[DFT_BACKEND_NUM];
+    dft_benchmark(cycles);
+#endif
 
     // infinite loop
     while (1) {
         player_loop();
+        // Top up the read ahead of the songs between the refills.
+        player_lock();
+        songs_loop();
+        player_unlock();
+        // The dft takes a while, only run it when the player has time to spare.
+        if (!player_is_refill_pending()) {
+            analyzer_loop();
+        }
         display_loop();
         // React to button presses and poti changes every 100 ms.
         static uint32_t last_ticks;
@@ -61,6 +164,12 @@ int main(void) {
         if (ticks - last_ticks > 100) {
             last_ticks = ticks;
             handle_input();
+            queue_next_song();
+        }
+        // the refill switched to the next song
+        if (song_changed) {
+            song_changed = 0;
+            display_set_song(selected_song);
         }
     }
 
@@ -69,25 +178,172 @@ int main(void) {
 }
 
 int load_audio_data(int16_t *data, size_t *length) {
+    size_t requested = *length;
     int err = songs_read_song(selected_song, data, length);
-    // The audio samples, that will be transformed with dft are out of sync with
-    // the music being played by 20ms. Because in this function call the next
-    // chunk of samples is preloaded while the previous is still playing. So by
-    // calculating the dft based on this new chunk, and sending it to the lcd
-    // we are out of sync. However, because the dft calculation uses quite some
-    // time, it may just be in sync again.
-    uint32_t magnitude[DFT_MAGNITUDE_SIZE];
-    dft_transform(data, magnitude);
-    display_set_spectogram(magnitude + 1, UINT32_MAX);
+#if (CROSSFADE_SAMPLES > 0)
+    if (!err && queued_song) {
+        err = crossfade_audio_data(data, length, requested);
+    }
+#endif
+    if (!err && *length < requested && queued_song) {
+        // The song ended, fill the rest of the buffer with the start of the
+        // queued song. Its first blocks are read ahead already.
+        size_t rest = requested - *length;
+        err = songs_read_song(queued_song, data + *length, &rest);
+        *length += rest;
+        selected_song = queued_song;
+        selected_nr++;
+        queued_song = NULL;
+        song_changed = 1;
+    }
+    // Only copy the samples for the dft, it runs later in the main loop so that
+    // it doesn't delay the refill of the player.
+    if (!err) {
+        analyzer_push(data, *length, player_get_load_position());
+    }
+    return err;
+}
+
+#if (CROSSFADE_SAMPLES > 0)
+int crossfade_audio_data(int16_t *data, size_t *length, size_t requested) {
+    // word aligned for the SIMD mix
+    static int16_t incoming[PLAYER_BUFFER_SIZE] __attribute__((aligned(4)));
+    if (!fade_duration) {
+        // Fade over what was left of the song before this chunk. That is less
+        // than CROSSFADE_SAMPLES if the song is shorter.
+        size_t left = selected_song->info.samples - selected_song->samples_read + *length;
+        if (!left || left > CROSSFADE_SAMPLES) {
+            return 0;
+        }
+        fade_duration = left;
+        fade_position = 0;
+    }
+    // The queued song is read ahead already. Where one of the songs ended its
+    // part is silent.
+    size_t read = requested;
+    int err = songs_read_song(queued_song, incoming, &read);
+    memset(data + *length, 0, (requested - *length) * sizeof(int16_t));
+    memset(incoming + read, 0, (requested - read) * sizeof(int16_t));
+    size_t mixed = (*length > read) ? *length : read;
+    mixer_crossfade(data, incoming, data, mixed, fade_position, fade_duration);
+    fade_position += mixed;
+    if (*length < requested) {
+        // the playing song ended, the queued song goes on by itself
+        selected_song = queued_song;
+        selected_nr++;
+        queued_song = NULL;
+        song_changed = 1;
+        fade_duration = 0;
+    }
+    *length = mixed;
     return err;
 }
+#endif
+
+void analyze_audio_data(int16_t *data, uint32_t timestamp, int latest) {
+    // The chunk was loaded up to (PLAYER_BUFFER_NUM + 1) * 20 ms before it gets
+    // played. The display holds the spectogram back until the playback
+    // position reaches the timestamp of the chunk, so that the bars show what
+    // is heard. The dft window ends with the chunk and reaches about as far
+    // into the previous one, its center is close to the start of the chunk.
+    // Static, the magnitudes of both channels take 2 KiB and would use half of
+    // the stack. Only the main loop calls this, so sharing them is safe.
+    static uint32_t magnitude[DFT_CHANNELS_NUM * DFT_MAGNITUDE_SIZE];
+    static uint32_t bands[DFT_BANDS_NUM];
+    // Every chunk goes through the decimator and into the window of the dft,
+    // so that it stays continuous. Only the newest one gets transformed.
+    dft_update(data);
+    if (!latest) {
+        return;
+    }
+    dft_get_magnitude(magnitude);
+    // levels in dB, both spectra averaged in stereo mode
+    dft_map_bands(magnitude, bands);
+    display_queue_spectogram(bands, DFT_BANDS_FULL_SCALE, timestamp);
+}
+
+void queue_next_song(void) {
+    // The refill reads and switches the songs from an interrupt, hold it back
+    // while they are looked at.
+    player_lock();
+    int due = playing && !queued_song && selected_nr + 1 < songs_count &&
+              selected_song->info.samples - selected_song->samples_read < QUEUE_SAMPLES;
+    // The next song is opened with the song object the playing song does not
+    // use. The refill does not read it anymore, drop it from the read ahead.
+    size_t nr = selected_nr + 1;
+    song_t *next = (selected_song == &opened_songs[0]) ? &opened_songs[1] : &opened_songs[0];
+    if (due) {
+        songs_close_song(next);
+    }
+    player_unlock();
+    if (!due) {
+        return;
+    }
+    // Look the next song up in the library, then parse the headers and build
+    // its link map. That reads from the SD-Card and walks the FAT, the playing
+    // song goes on meanwhile.
+    song_info_t info;
+    size_t length = 1;
+    if (songs_list_songs(nr, &info, &length) || !length || songs_open_song(info.filename, next)) {
+        return;
+    }
+    // start to read ahead its first blocks
+    player_lock();
+    if (playing && !queued_song && selected_nr + 1 == nr && !songs_queue_song(next)) {
+        queued_song = next;
+    }
+    player_unlock();
+}
+
+void restart_crossfade(void) {
+    if (fade_duration) {
+        fade_duration = 0;
+        songs_seek_song(queued_song, 0);
+    }
+}
+
+void jump_to_letter(int direction) {
+    song_info_t info;
+    size_t position;
+    if (display_get_selection(&info, &position)) {
+        return;
+    }
+    // one letter prefixes, compared without regard to the case
+    char prefix[2] = {tolower((unsigned char)info.artist[0]), '\0'};
+    size_t first = position;
+    // The library is read from the SD-Card, hold back the refill of the player.
+    player_lock();
+    if (direction) {
+        // up
+        if (!songs_find_song(prefix, &first) && first == position) {
+            // take the initial of the song before, the first one goes on
+            // with the last initial
+            size_t length = 1;
+            size_t before = position ? position - 1 : songs_count - 1;
+            if (!songs_list_songs(before, &info, &length) && length) {
+                prefix[0] = tolower((unsigned char)info.artist[0]);
+                songs_find_song(prefix, &first);
+            }
+        }
+    } else {
+        // down, after the last initial the list starts over
+        prefix[0]++;
+        if (!songs_find_song(prefix, &first) && first >= songs_count) {
+            first = 0;
+        }
+    }
+    player_unlock();
+    display_set_selection(first);
+}
 
 void handle_input(void) {
     // React to (new) button presses:
     // Button 0: Play currently selected song (changes display to song view).
     // Button 1: Stop playing song (changes display to list view).
-    // Button 2: Move selection down in list (has only an effect in list view).
-    // Button 3: Move selection up in list (has only an effect in list view).
+    // Button 2: Move selection down in list (list view) or skip forward (song
+    //           view). Held in list view it jumps to the next initial.
+    // Button 3: Move selection up in list (list view) or skip back (song view).
+    //           Held in list view it jumps to the previous initial.
     static uint8_t last_buttons;
     uint8_t current_buttons;
     CARME_IO1_BUTTON_Get(&current_buttons);
@@ -95,24 +351,74 @@ void handle_input(void) {
     last_buttons = current_buttons;
     if (changed_buttons & 0x01) {
         // play
-        // get selected song from display
-        display_get_selection(&selected_song);
+        // get selected song from display, in song view the playing one starts
+        // over
+        song_info_t info = {0};
+        size_t nr = selected_nr;
+        if (display_get_selection(&info, &nr) && selected_song) {
+            info = selected_song->info;
+        }
+        // The refill reads the selected song from an interrupt. Let it play on
+        // by itself and open the song with the other song object meanwhile.
+        player_lock();
+        queued_song = NULL;
+        fade_duration = 0;
+        song_t *song = (selected_song == &opened_songs[0]) ? &opened_songs[1] : &opened_songs[0];
+        songs_close_song(song);
+        player_unlock();
         // load the song (should not fail as the song was already validated)
-        songs_open_song(selected_song->filename, selected_song);
-        // start player
+        if (songs_open_song(info.filename, song)) {
+            return;
+        }
+        // switch over to it and start player
+        player_lock();
+        selected_song = song;
+        selected_nr = nr;
+        songs_start_song(selected_song);
+        playing = 1;
         player_play();
+        player_unlock();
         // display song info
         display_set_song(selected_song);
     } else if (changed_buttons & 0x02) {
         // stop
         player_stop();
-        display_set_list(songs, songs_count);
+        queued_song = NULL;
+        fade_duration = 0;
+        playing = 0;
+        display_set_list(songs_count, songs_list_songs);
     } else if (changed_buttons & 0x04) {
-        // move down
-        display_move_selection(0);
+        // move down, fails in song view
+        if (display_move_selection(0) && playing) {
+            // Skip forward. The buffers that are already loaded play out
+            // first, the jump comes without a gap right after them.
+            player_lock();
+            songs_seek_song(selected_song, selected_song->samples_read + SKIP_SAMPLES);
+            restart_crossfade();
+            player_unlock();
+        }
     } else if (changed_buttons & 0x08) {
-        // move up
-        display_move_selection(1);
+        // move up, fails in song view
+        if (display_move_selection(1) && playing) {
+            // skip back
+            player_lock();
+            size_t read = selected_song->samples_read;
+            songs_seek_song(selected_song, (read > SKIP_SAMPLES) ? read - SKIP_SAMPLES : 0);
+            restart_crossfade();
+            player_unlock();
+        }
+    }
+    // Holding a move button in the list jumps from initial to initial of the
+    // artists, after it moved by one song when it was pressed.
+    static uint8_t held_ticks;
+    if (!playing && (current_buttons & 0x0C) && !changed_buttons) {
+        if (held_ticks < JUMP_HOLD_TICKS) {
+            held_ticks++;
+        } else {
+            jump_to_letter((current_buttons & 0x08) != 0);
+        }
+    } else {
+        held_ticks = 0;
     }
     // React to (significant) potentiometer changes.
     static uint16_t last_poti;
@@ -0,0 +1,84 @@
+/**
+ * @file mixer.c
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Module for the crossfade of two songs.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ * 
+ * Theoretical source for this implementation:
+ * https://en.wikipedia.org/wiki/Fade_(audio_engineering)#Crossfading
+ */
+
+#include "mixer.h"
+#include "simd.h"
+#include "utils.h"
+#include <math.h>
+
+#if (MIXER_GAIN_STEPS != 256)
+#error "MIXER_GAIN_STEPS has to be 256."
+#endif
+
+#define MIXER_PI (3.14159265358979323846f)
+
+#define MIXER_GAIN_ENTRY(i) (uint16_t) roundf(32768.0f * sinf(MIXER_PI / 2 * (i) / MIXER_GAIN_STEPS)),
+
+/**
+ * @brief Quarter period of a sine in Q15 format.
+ * 
+ * Generated at compile time. Unsigned, so that the gain of one fits. Entry i
+ * is the gain of the incoming song after i / MIXER_GAIN_STEPS of the
+ * crossfade, entry MIXER_GAIN_STEPS - i the one of the outgoing song.
+ */
+static const uint16_t g_gains[MIXER_GAIN_STEPS + 1] = {REP_256(MIXER_GAIN_ENTRY, 0) MIXER_GAIN_ENTRY(256)};
+
+/**
+ * @brief Scale both halfwords of a stereo sample by the same Q15 gain.
+ * 
+ * @param sample two packed signed halfwords
+ * @param gain gain in Q15 format, from zero up to one
+ * @return two packed signed halfwords
+ */
+static inline uint32_t scale(uint32_t sample, int32_t gain) {
+    // round instead of truncate
+    int32_t left = ((int32_t)(int16_t)sample * gain + (1 << 14)) >> 15;
+    int32_t right = ((int32_t)(int16_t)(sample >> 16) * gain + (1 << 14)) >> 15;
+    return __PKHBT(left, right, 16);
+}
+
+void mixer_crossfade(const int16_t *outgoing, const int16_t *incoming, int16_t *mixed, size_t length,
+                     uint32_t position, uint32_t duration) {
+    // Progress of the crossfade in Q24 steps of the gain table. The remainder
+    // of the division is carried along, so the phase is exact at every pair
+    // and a crossfade mixed in blocks gives the same samples as one mixed at
+    // once. Both samples of a stereo pair get the same gain, so it advances
+    // once per pair.
+    uint64_t phase = (uint64_t)position * ((uint64_t)MIXER_GAIN_STEPS << 24);
+    uint32_t remainder = phase % duration;
+    phase /= duration;
+    uint64_t step = ((uint64_t)2 * MIXER_GAIN_STEPS << 24);
+    uint32_t step_remainder = step % duration;
+    step /= duration;
+    for (size_t n = 0; n < length / 2; ++n) {
+        if (phase >= ((uint64_t)MIXER_GAIN_STEPS << 24)) {
+            // crossfade is over, only the incoming song is left
+            write_q15x2(mixed + 2 * n, read_q15x2(incoming + 2 * n));
+            continue;
+        }
+        uint32_t i = phase >> 24;
+        int32_t fraction = (phase >> 8) & 0xFFFF;
+        int32_t fade_in = g_gains[i] + (((g_gains[i + 1] - g_gains[i]) * fraction) >> 16);
+        int32_t fade_out = g_gains[MIXER_GAIN_STEPS - i] -
+                           (((g_gains[MIXER_GAIN_STEPS - i] - g_gains[MIXER_GAIN_STEPS - i - 1]) * fraction) >> 16);
+        uint32_t out = scale(read_q15x2(outgoing + 2 * n), fade_out);
+        uint32_t in = scale(read_q15x2(incoming + 2 * n), fade_in);
+        write_q15x2(mixed + 2 * n, __QADD16(out, in));
+        phase += step;
+        remainder += step_remainder;
+        if (remainder >= duration) {
+            remainder -= duration;
+            phase++;
+        }
+    }
+}
@@ -16,6 +16,7 @@
 #include <stdio.h>
 
 #include "player.h"
+#include "utils.h"
 
 #define TIMEOUT (1000U) //!< timeout after which busy-wait loops are aborted
 
@@ -36,38 +37,105 @@ static __IO enum {
     PLAYER_STOPPING
 } g_state;
 
-enum {
-    LOWER_HALF = 0,
-    UPPER_HALF,
-    MAX_HALF
-};
+#if (PLAYER_BUFFER_NUM < 2)
+#error "PLAYER_BUFFER_NUM has to be at least two."
+#endif
 
 static player_load_data_callback g_callback; //!< user callback to load new data
 
 /**
- * @brief Buffer for audio data.
+ * @brief Ring of buffers for audio data.
  * 
- * The user writes data into this buffer (via the callback).
- * The DMA reads data from this buffer.
- * Carefull synchronization is needed so that the writing and reading does not
- * interfere with each other. If the user callback is returning data too slowly
- * a audible studder is hearable.
+ * The user writes data into the buffers (via the callback) in order of the
+ * ring. The DMA reads them in the same order. It runs in double buffer mode
+ * and switches between two memory targets, each time one target is finished
+ * the ISR gives it the next buffer of the ring. If the user callback is
+ * returning data too slowly the ring runs empty and silence is sent out
+ * instead, a audible studder is hearable. Word aligned, so that the SD-Card can
+ * be read into them with DMA.
  */
-static int16_t g_buffer[MAX_HALF * PLAYER_BUFFER_SIZE];
+static int16_t g_buffers[PLAYER_BUFFER_NUM][PLAYER_BUFFER_SIZE] __attribute__((aligned(4)));
+
+static int16_t g_silence[PLAYER_BUFFER_SIZE]; //!< sent out when the ring is empty
+
+/**
+ * @brief State of the ring.
+ * 
+ * The indices are counts of buffers, their differences are the counts of
+ * buffers in a state. Head is only written by the main loop, all others only
+ * by the ISR.
+ */
+static struct {
+    __IO uint32_t head;      //!< count of loaded buffers
+    __IO uint32_t tail;      //!< count of buffers given to the DMA
+    __IO uint32_t done;      //!< count of buffers that finished playing
+    __IO uint32_t completed; //!< count of finished DMA transfers, buffers or silence
+    __IO int from_ring[2];   //!< 1 if memory target 0 / 1 is a buffer of the ring
+} g_ring;
+
+/**
+ * @brief Glitch accounting.
+ * 
+ * Counters are of the current session and get reset by \ref player_play().
+ * The refill writes refills and slack, the ISR everything else.
+ */
+static struct {
+    __IO int primed;           //!< the DMA got the first buffer of the session
+    __IO uint32_t refills;     //!< count of loaded buffers
+    __IO uint32_t underruns;   //!< count of silence sent out instead of a buffer
+    __IO uint32_t missed_irqs; //!< count of DMA interrupts that came too late
+    __IO uint32_t min_slack;   //!< least halfwords queued when a refill started
+    uint32_t last_complete;    //!< cycle count of the last finished transfer
+    player_glitch_t log[PLAYER_GLITCH_LOG_SIZE]; //!< ring of the last glitches
+    __IO uint32_t logged;      //!< count of logged glitches
+} g_glitch;
+
+static uint32_t g_load_position; //!< playback position of the data being loaded
 
 static struct {
-    __IO int valid[MAX_HALF]; //!< 1 if lower / upper half of buffer has valid data
-} g_flags;
+    __IO uint32_t count;  //!< nesting count of \ref player_lock()
+    __IO int deferred;    //!< a refill got due while locked
+} g_lock;
+
+/**
+ * @brief Add a glitch to the log.
+ * 
+ * @param type what happened
+ * @param position playback position of the glitch
+ */
+static void log_glitch(player_glitch_type_t type, uint32_t position);
+
+/**
+ * @brief Load every free buffer of the ring with data.
+ * 
+ */
+static void refill(void);
+
+/**
+ * @brief Request a refill.
+ * 
+ * Either pends the refill interrupt or, without PLAYER_REFILL_IN_ISR, leaves
+ * it to \ref player_loop().
+ */
+static void request_refill(void);
+
+/**
+ * @brief Get the current position of the DMA.
+ * 
+ * @param[out] completed count of finished DMA transfers
+ * @param[out] remaining count of halfwords left in the current transfer
+ */
+static void get_dma_position(uint32_t *completed, uint32_t *remaining);
 
 /**
- * @brief Load a half of the buffer with data.
+ * @brief Load the next buffer of the ring with data.
  * 
  * Calls the user callback to get new data.
  * 
- * @param half 0 for the lower half or 1 for the upper half
+ * @param count count of the buffer in the ring, e.g. the current head
  * @retval length of the read data, is normally \ref PLAYER_BUFFER_SIZE
  */
-static size_t load_data(int half);
+static size_t load_data(uint32_t count);
 
 int player_init(player_load_data_callback callback) {
     // check current state
@@ -115,24 +183,26 @@ int player_init(player_load_data_callback callback) {
     }
     DMA_DeInit(DMA1_Stream4);
 
-    // initialize DMA in circular mode
+    // Initialize DMA in double buffer mode (needs circular mode), both memory
+    // targets send out silence until the first buffers are loaded.
     DMA_InitTypeDef DMA_config;
     DMA_StructInit(&DMA_config);
     DMA_config.DMA_PeripheralBaseAddr = (uint32_t)&CODEC_I2S->DR;
-    DMA_config.DMA_Memory0BaseAddr = (uint32_t)g_buffer;
+    DMA_config.DMA_Memory0BaseAddr = (uint32_t)g_silence;
     DMA_config.DMA_DIR = DMA_DIR_MemoryToPeripheral;
-    DMA_config.DMA_BufferSize = MAX_HALF * PLAYER_BUFFER_SIZE;
+    DMA_config.DMA_BufferSize = PLAYER_BUFFER_SIZE;
     DMA_config.DMA_MemoryInc = DMA_MemoryInc_Enable;
     DMA_config.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
     DMA_config.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
     DMA_config.DMA_Mode = DMA_Mode_Circular;
     DMA_Init(DMA1_Stream4, &DMA_config);
+    DMA_DoubleBufferModeConfig(DMA1_Stream4, (uint32_t)g_silence, DMA_Memory_0);
+    DMA_DoubleBufferModeCmd(DMA1_Stream4, ENABLE);
 
     // setup interrupts:
-    // - transfer half complete
-    // - transfer complete
+    // - transfer complete (of one memory target)
     DMA_ClearITPendingBit(DMA1_Stream4, DMA_IT_HTIF4 | DMA_IT_TCIF4);
-    DMA_ITConfig(DMA1_Stream4, DMA_IT_HT | DMA_IT_TC, ENABLE);
+    DMA_ITConfig(DMA1_Stream4, DMA_IT_TC, ENABLE);
     NVIC_InitTypeDef NVIC_config;
     NVIC_config.NVIC_IRQChannel = DMA1_Stream4_IRQn;
     NVIC_config.NVIC_IRQChannelPreemptionPriority = 0;
@@ -154,10 +224,18 @@ int player_init(player_load_data_callback callback) {
 
     // enable i2s peripheral
     I2S_Cmd(CODEC_I2S, ENABLE);
+    g_glitch.last_complete = get_cycles();
+    g_glitch.min_slack = UINT32_MAX;
+
+#ifdef PLAYER_REFILL_IN_ISR
+    // The refill runs in the interrupt with the lowest priority, so that it
+    // only ever interrupts the main loop.
+    NVIC_SetPriority(PendSV_IRQn, (1U << __NVIC_PRIO_BITS) - 1U);
+#endif
 
     // From here on the DMA stream is always running and the i2s peripheral e.g.
     // the codec is always fed with data. To "stop" the output of audio the
-    // buffer is filled with zeros so that only silence is sent out.
+    // ring is left empty so that only silence is sent out.
     g_state = PLAYER_STOPPED;
     return 0;
 }
@@ -172,46 +250,87 @@ int player_loop(void) {
         // noting to do
         break;
     case (PLAYER_PLAYING):
-        // Check if the lower (0) or upper (1) half of the buffer was already
-        // transfered. If so, request new data from registered callback.
-        for (int i = LOWER_HALF; i < MAX_HALF; ++i) {
-            if (!g_flags.valid[i]) {
-                size_t length = load_data(i);
-                g_flags.valid[i] = 1;
-                if (length < PLAYER_BUFFER_SIZE) {
-                    // We got less than the buffersize of data back. Fill the
-                    // remainder of the buffer with silence.
-                    size_t offset = i * PLAYER_BUFFER_SIZE + length;
-                    size_t remainder = (PLAYER_BUFFER_SIZE - length) * sizeof(int16_t);
-                    memset(g_buffer + offset, 0, remainder);
-                    g_state = PLAYER_STOPPING;
-                }
-            }
-        }
-        // The upper code fills the buffer always from the lower half on. But
-        // that half could be in use by the dma and the loaded data would never
-        // be sent out. (As the ISR resets the valid flag, the upper code would
-        // then overwrite the unsent data.) So up to PLAYER_BUFFER_SIZE of data
-        // will not be sent out. But "normal" sound data would anyway start near
-        // silent and PLAYER_BUFFER_SIZE relative to the whole audio stream size
-        // is less than 1 %.
-        break;
     case (PLAYER_STOPPING):
-        // We are stopping and ISR is sending the last data. Wait until all data
-        // is sent and then clear buffer.
-        if (!g_flags.valid[LOWER_HALF] && !g_flags.valid[UPPER_HALF]) {
-            memset(g_buffer, 0, sizeof(g_buffer[0]) * MAX_HALF * PLAYER_BUFFER_SIZE);
-            g_state = PLAYER_STOPPED;
-        }
+#ifndef PLAYER_REFILL_IN_ISR
+        refill();
+#endif
+        break;
+    }
+    return 0;
+}
+
+int player_is_refill_pending(void) {
+    return g_state == PLAYER_PLAYING && g_ring.head - g_ring.done < PLAYER_BUFFER_NUM;
+}
+
+uint32_t player_get_position(void) {
+    uint32_t completed, remaining;
+    get_dma_position(&completed, &remaining);
+    return (completed + 1) * PLAYER_BUFFER_SIZE - remaining;
+}
+
+uint32_t player_get_load_position(void) {
+    return g_load_position;
+}
+
+int player_get_stats(player_stats_t *stats) {
+    if (g_state == PLAYER_NOT_INITIALIZED || !stats) {
+        return -1;
     }
+    stats->depth = PLAYER_BUFFER_NUM;
+    stats->fill = g_ring.head - g_ring.done;
+    stats->refills = g_glitch.refills;
+    stats->underruns = g_glitch.underruns;
+    stats->missed_irqs = g_glitch.missed_irqs;
+    if (g_glitch.min_slack == UINT32_MAX) {
+        // no refill with a primed DMA yet
+        stats->min_slack_us = UINT32_MAX;
+    } else {
+        stats->min_slack_us = (uint64_t)g_glitch.min_slack * 1000000U / (2U * 48000U);
+    }
+    return 0;
+}
+
+int player_get_glitches(player_glitch_t glitches[PLAYER_GLITCH_LOG_SIZE], size_t *count) {
+    if (!glitches || !count) {
+        return -1;
+    }
+    // copy in one go, the ISR could log a new glitch in between
+    __disable_irq();
+    uint32_t logged = g_glitch.logged;
+    *count = logged < PLAYER_GLITCH_LOG_SIZE ? logged : PLAYER_GLITCH_LOG_SIZE;
+    for (size_t i = 0; i < *count; ++i) {
+        glitches[i] = g_glitch.log[(logged - *count + i) % PLAYER_GLITCH_LOG_SIZE];
+    }
+    __enable_irq();
     return 0;
 }
 
+void player_lock(void) {
+    g_lock.count++;
+}
+
+void player_unlock(void) {
+    if (--g_lock.count == 0 && g_lock.deferred) {
+        g_lock.deferred = 0;
+        request_refill();
+    }
+}
+
 int player_play(void) {
     if (g_state == PLAYER_NOT_INITIALIZED) {
         return -1;
     }
+    // start a new session
+    __disable_irq();
+    g_glitch.primed = 0;
+    g_glitch.refills = 0;
+    g_glitch.underruns = 0;
+    g_glitch.missed_irqs = 0;
+    g_glitch.min_slack = UINT32_MAX;
+    __enable_irq();
     g_state = PLAYER_PLAYING;
+    request_refill();
     return 0;
 }
 
@@ -230,31 +349,159 @@ void player_set_volume(uint8_t volume) {
 }
 
 void DMA1_Stream4_IRQHandler(void) {
-    // Check what triggered the interrupt. If it was transfer half complete then
-    // we set a flag to reload the lower half of the buffer. If the interrupt
-    // was from the transfer complete we set a flag to reload the upper half.
-    int half;
-    if (DMA_GetITStatus(DMA1_Stream4, DMA_IT_TCIF4) == SET) {
-        // transfer complete
-        half = UPPER_HALF;
-    } else if (DMA_GetITStatus(DMA1_Stream4, DMA_IT_HTIF4) == SET) {
-        // transfer half complete
-        half = LOWER_HALF;
-    } else {
+    if (DMA_GetITStatus(DMA1_Stream4, DMA_IT_TCIF4) != SET) {
         // should not get here, ignore
         return;
     }
     // clear the interrupt flags
     DMA_ClearITPendingBit(DMA1_Stream4, DMA_IT_HTIF4 | DMA_IT_TCIF4);
-    // tell the main loop to reload the buffer half
-    g_flags.valid[half] = 0;
+    // Estimate when the transfer finished, from how far the DMA already got
+    // into the next one. If more than one and a half transfers passed since
+    // the last, this interrupt came too late. The DMA already switched back to
+    // the finished target and sent its stale data again.
+    uint32_t cycles_per_halfword = SystemCoreClock / (2U * 48000U);
+    uint32_t complete = get_cycles() - (PLAYER_BUFFER_SIZE - DMA_GetCurrDataCounter(DMA1_Stream4)) * cycles_per_halfword;
+    int missed = complete - g_glitch.last_complete > 3U * PLAYER_BUFFER_SIZE * cycles_per_halfword / 2U;
+    g_glitch.last_complete = complete;
+    // The DMA already switched over to the other memory target. The finished
+    // one is free and gets the next buffer of the ring or silence.
+    int finished = DMA_GetCurrentMemoryTarget(DMA1_Stream4) ? 0 : 1;
+    if (g_ring.from_ring[finished]) {
+        g_ring.done++;
+    }
+    int16_t *next;
+    uint32_t tail = g_ring.tail;
+    if (tail != g_ring.head) {
+        next = g_buffers[tail % PLAYER_BUFFER_NUM];
+        g_ring.tail = tail + 1;
+        g_ring.from_ring[finished] = 1;
+        g_glitch.primed = 1;
+    } else {
+        next = g_silence;
+        g_ring.from_ring[finished] = 0;
+    }
+    DMA_MemoryTargetConfig(DMA1_Stream4, (uint32_t)next, finished ? DMA_Memory_1 : DMA_Memory_0);
+    // count the transfer that was sent again too
+    g_ring.completed += missed ? 2 : 1;
+    // Glitches are only of interest while playing. At the start of a session
+    // the ring is allowed to be empty and at the end it runs empty.
+    if (g_state == PLAYER_PLAYING && g_glitch.primed) {
+        uint32_t position = g_ring.completed * PLAYER_BUFFER_SIZE;
+        if (missed) {
+            // the current transfer is the stale one
+            g_glitch.missed_irqs++;
+            log_glitch(PLAYER_GLITCH_MISSED_IRQ, position);
+        }
+        if (next == g_silence) {
+            // the silence is sent after the current transfer
+            g_glitch.underruns++;
+            log_glitch(PLAYER_GLITCH_UNDERRUN, position + PLAYER_BUFFER_SIZE);
+        }
+    }
+    // a buffer may have become free
+    request_refill();
+}
+
+#ifdef PLAYER_REFILL_IN_ISR
+void PendSV_Handler(void) {
+    refill();
+}
+#endif
+
+static void refill(void) {
+    if (g_lock.count) {
+        // the main loop uses what the callback needs, retry on unlock
+        g_lock.deferred = 1;
+        return;
+    }
+    switch (g_state) {
+    case (PLAYER_PLAYING):
+        // Load every buffer of the ring that is not waiting or being played.
+        while (g_ring.head - g_ring.done < PLAYER_BUFFER_NUM) {
+            uint32_t head = g_ring.head;
+            int16_t *buffer = g_buffers[head % PLAYER_BUFFER_NUM];
+            size_t length = load_data(head);
+            if (length < PLAYER_BUFFER_SIZE) {
+                // We got less than the buffersize of data back. Fill the
+                // remainder of the buffer with silence.
+                size_t remainder = (PLAYER_BUFFER_SIZE - length) * sizeof(int16_t);
+                memset(buffer + length, 0, remainder);
+                g_state = PLAYER_STOPPING;
+            }
+            // make sure the data is written before the ISR can see the buffer
+            __DMB();
+            g_ring.head = head + 1;
+            if (g_state != PLAYER_PLAYING) {
+                break;
+            }
+        }
+        break;
+    case (PLAYER_STOPPING):
+        // We are stopping and ISR is sending the last data. Wait until all
+        // loaded buffers are sent, from then on only silence is sent.
+        if (g_ring.done == g_ring.head) {
+            g_state = PLAYER_STOPPED;
+        }
+        break;
+    default:
+        break;
+    }
 }
 
-static size_t load_data(int half) {
+static void request_refill(void) {
+#ifdef PLAYER_REFILL_IN_ISR
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+#endif
+}
+
+static void get_dma_position(uint32_t *completed, uint32_t *remaining) {
+    int switched;
+    // Retry if the ISR counted a transfer in between, count and transfer
+    // counter would not belong together.
+    do {
+        *completed = g_ring.completed;
+        *remaining = DMA_GetCurrDataCounter(DMA1_Stream4);
+        switched = DMA_GetFlagStatus(DMA1_Stream4, DMA_FLAG_TCIF4) == SET;
+    } while (*completed != g_ring.completed);
+    // The DMA may already have switched the target but the ISR did not yet
+    // count the transfer. Then the counter was reloaded and is nearly full.
+    if (switched && *remaining > PLAYER_BUFFER_SIZE / 2) {
+        (*completed)++;
+    }
+}
+
+static size_t load_data(uint32_t count) {
+    // The transfer that follows the current one is already set up. The next
+    // free target gets the oldest waiting buffer, this one plays after all
+    // buffers that are waiting before it. Silence is only inserted if none are
+    // waiting, so this holds even with underruns.
+    // The slack is the audio that the DMA has left before it runs out, the rest
+    // of the current transfer, the next transfer and the waiting buffers.
+    uint32_t completed, remaining, tail, slack;
+    do {
+        get_dma_position(&completed, &remaining);
+        tail = g_ring.tail;
+        int current = DMA_GetCurrentMemoryTarget(DMA1_Stream4) ? 1 : 0;
+        slack = (g_ring.from_ring[current] ? remaining : 0) +
+                (g_ring.from_ring[!current] ? PLAYER_BUFFER_SIZE : 0) +
+                (count - tail) * PLAYER_BUFFER_SIZE;
+    } while (completed != g_ring.completed);
+    g_load_position = (completed + 2 + (count - tail)) * PLAYER_BUFFER_SIZE;
+    if (g_glitch.primed && slack < g_glitch.min_slack) {
+        g_glitch.min_slack = slack;
+    }
+    g_glitch.refills++;
     size_t length = PLAYER_BUFFER_SIZE;
-    if (g_callback(&g_buffer[half * PLAYER_BUFFER_SIZE], &length)) {
+    if (g_callback(g_buffers[count % PLAYER_BUFFER_NUM], &length)) {
         // On error give a length of 0 back to initiate a stop sequence.
         length = 0;
     }
     return length;
 }
+
+static void log_glitch(player_glitch_type_t type, uint32_t position) {
+    uint32_t i = g_glitch.logged % PLAYER_GLITCH_LOG_SIZE;
+    g_glitch.log[i].type = type;
+    g_glitch.log[i].position = position;
+    g_glitch.logged++;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file resampler.c
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Module for the sample rate conversion of songs to 48 kHz.
+ * @version 0.1
+ * @date 2026-10-16
+ * 
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ * 
+ * Theoretical source for this implementation:
+ * https://en.wikipedia.org/wiki/Sample-rate_conversion
+ * https://en.wikipedia.org/wiki/Polyphase_quadrature_filter
+ */
+
+#include "resampler.h"
+#include "simd.h"
+#include "utils.h"
+#include <math.h>
+#include <string.h>
+
+// Upsampling by up followed by downsampling by down. 44.1 kHz * 160 / 147 and
+// 32 kHz * 3 / 2 are 48 kHz.
+#define RESAMPLER_UP_44K (160U)
+#define RESAMPLER_DOWN_44K (147U)
+#define RESAMPLER_UP_32K (3U)
+#define RESAMPLER_DOWN_32K (2U)
+
+#if (RESAMPLER_TAPS == 16)
+#define RESAMPLER_REP_44K(m) REP_2048(m, 0) REP_512(m, 2048)
+#define RESAMPLER_REP_32K(m) REP_32(m, 0) REP_16(m, 32)
+#elif (RESAMPLER_TAPS == 32)
+#define RESAMPLER_REP_44K(m) REP_4096(m, 0) REP_1024(m, 4096)
+#define RESAMPLER_REP_32K(m) REP_64(m, 0) REP_32(m, 64)
+#else
+#error "RESAMPLER_TAPS has to be 16 or 32."
+#endif
+
+#define RESAMPLER_PI (3.14159265358979323846f)
+
+/**
+ * @brief Cutoff of the lowpass relative to the nyquist frequency of the input.
+ * 
+ * Same as the one of the decimator, the rest is the transition band. Images of
+ * the input spectrum start where the transition band ends.
+ */
+#define RESAMPLER_CUTOFF (0.8f)
+
+// The prototype lowpass runs at up times the input rate and has up * taps
+// taps. Entry i of a table is tap j = i % taps of phase p = i / taps, that is
+// prototype tap (taps - 1 - j) * up + p. Reversed, so that the taps of a phase
+// run in the same direction as the input samples. The length is even, so the
+// center lies between two taps and the sinc never has to be evaluated at zero.
+#define RESAMPLER_N(up, i) ((RESAMPLER_TAPS - 1 - (i) % RESAMPLER_TAPS) * (up) + (i) / RESAMPLER_TAPS)
+#define RESAMPLER_T(up, i) (RESAMPLER_N(up, i) - ((up) * RESAMPLER_TAPS - 1) / 2.0f)
+#define RESAMPLER_SINC(up, i) \
+    (sinf(RESAMPLER_PI * RESAMPLER_CUTOFF * RESAMPLER_T(up, i) / (up)) / (RESAMPLER_PI * RESAMPLER_T(up, i) / (up)))
+#define RESAMPLER_WINDOW(up, i)                                                            \
+    (0.42f - 0.5f * cosf(2 * RESAMPLER_PI * RESAMPLER_N(up, i) / ((up) * RESAMPLER_TAPS - 1)) + \
+     0.08f * cosf(4 * RESAMPLER_PI * RESAMPLER_N(up, i) / ((up) * RESAMPLER_TAPS - 1)))
+#define RESAMPLER_TAP(up, i) (RESAMPLER_SINC(up, i) * RESAMPLER_WINDOW(up, i))
+
+#define RESAMPLER_TAP_ENTRY_44K(i) (int16_t) roundf(32768.0f * RESAMPLER_TAP(RESAMPLER_UP_44K, i)),
+#define RESAMPLER_TAP_ENTRY_32K(i) (int16_t) roundf(32768.0f * RESAMPLER_TAP(RESAMPLER_UP_32K, i)),
+
+/**
+ * @brief Taps of every phase of the polyphase lowpass in Q15 format.
+ * 
+ * Generated at compile time. Word aligned so that two taps at once can be
+ * loaded by SIMD instructions. The sum of the taps of every phase, e.g. its
+ * gain at DC, is one within a few per mille.
+ */
+static const int16_t g_taps_44k[RESAMPLER_UP_44K * RESAMPLER_TAPS] __attribute__((aligned(4))) = {
+    RESAMPLER_REP_44K(RESAMPLER_TAP_ENTRY_44K)};
+static const int16_t g_taps_32k[RESAMPLER_UP_32K * RESAMPLER_TAPS] __attribute__((aligned(4))) = {
+    RESAMPLER_REP_32K(RESAMPLER_TAP_ENTRY_32K)};
+
+int resampler_supports(uint32_t rate) {
+    return rate == 44100 || rate == 32000;
+}
+
+int resampler_init(resampler_t *resampler, uint32_t rate) {
+    if (rate == 44100) {
+        resampler->taps = g_taps_44k;
+        resampler->up = RESAMPLER_UP_44K;
+        resampler->down = RESAMPLER_DOWN_44K;
+    } else if (rate == 32000) {
+        resampler->taps = g_taps_32k;
+        resampler->up = RESAMPLER_UP_32K;
+        resampler->down = RESAMPLER_DOWN_32K;
+    } else {
+        return -1;
+    }
+    // start with silence, the first output only needs one input sample
+    memset(resampler->samples, 0, sizeof(resampler->samples));
+    resampler->phase = 0;
+    resampler->count = RESAMPLER_TAPS - 1;
+    resampler->index = 0;
+    return 0;
+}
+
+size_t resampler_space(resampler_t *resampler) {
+    // samples in front of the next window are not needed anymore
+    return 2 * (RESAMPLER_TAPS + RESAMPLER_INPUT_SIZE - resampler->count + resampler->index);
+}
+
+size_t resampler_write(resampler_t *resampler, const int16_t *samples, size_t length) {
+    if (resampler->index) {
+        // Drop the samples in front of the next window. Its start moves to an
+        // even index, so both copies of the input stay word aligned.
+        size_t keep = resampler->count - resampler->index;
+        for (int c = 0; c < 2; ++c) {
+            memmove(resampler->samples[c][0], resampler->samples[c][0] + resampler->index, keep * sizeof(int16_t));
+            memmove(resampler->samples[c][1], resampler->samples[c][1] + resampler->index, keep * sizeof(int16_t));
+        }
+        resampler->count = keep;
+        resampler->index = 0;
+    }
+    size_t frames = RESAMPLER_TAPS + RESAMPLER_INPUT_SIZE - resampler->count;
+    if (frames > length / 2) {
+        frames = length / 2;
+    }
+    for (size_t n = 0; n < frames; ++n) {
+        uint32_t k = resampler->count + n;
+        for (int c = 0; c < 2; ++c) {
+            int16_t x = samples ? samples[2 * n + c] : 0;
+            resampler->samples[c][0][k] = x;
+            resampler->samples[c][1][k - 1] = x;
+        }
+    }
+    resampler->count += frames;
+    return 2 * frames;
+}
+
+size_t resampler_read(resampler_t *resampler, int16_t *samples, size_t length) {
+    size_t n = 0;
+    while (n + 2 <= length && resampler->index + RESAMPLER_TAPS <= resampler->count) {
+        // The window of this output starts at index. Take the copy of the input
+        // where it is word aligned.
+        uint32_t index = resampler->index;
+        const int16_t *taps = resampler->taps + resampler->phase * RESAMPLER_TAPS;
+        for (int c = 0; c < 2; ++c) {
+            const int16_t *window = resampler->samples[c][index & 1] + (index & ~1U);
+            int32_t acc = 1 << 14; // round instead of truncate
+            for (int k = 0; k < RESAMPLER_TAPS / 2; ++k) {
+                acc = __SMLAD(read_q15x2(window + 2 * k), read_q15x2(taps + 2 * k), acc);
+            }
+            acc >>= 15;
+            samples[n + c] = (acc > INT16_MAX) ? INT16_MAX : (acc < INT16_MIN) ? INT16_MIN : acc;
+        }
+        n += 2;
+        // advance by one output, that is down phases
+        resampler->phase += resampler->down;
+        while (resampler->phase >= resampler->up) {
+            resampler->phase -= resampler->up;
+            resampler->index++;
+        }
+    }
+    return n;
+}
@@ -14,9 +14,14 @@
  * 
  */
 
+#include <stm32f4xx.h>
 #include <string.h>
+#include <strings.h>
 
+#include "diskio.h"
+#include "resampler.h"
 #include "songs.h"
+#include "utils.h"
 
 // general chunk header
 typedef struct __attribute__((packed)) {
@@ -44,17 +49,271 @@ typedef struct __attribute__((packed)) {
     char format[4]; // "INFO"
 } list_chunk_t;
 
+#define INDEX_VERSION (2U)              // increment whenever the layout of the records changes
+#define INDEX_TEMP_FILE_NAME "SONGS.TMP" // new index while it is written
+#define SORT_TEMP_FILE_NAME "SONGS.RUN"  // runs of the sort, alternates with INDEX_TEMP_FILE_NAME
+#define SORT_RUN_LENGTH (8U)             // records that are sorted in RAM before the runs are merged
+
+// header of the library index
+typedef struct __attribute__((packed)) {
+    char magic[4];        // "SIDX"
+    uint16_t version;     // INDEX_VERSION
+    uint16_t record_size; // size of one record, changes with the string lengths
+    uint32_t count;       // count of records that follow
+    uint32_t covers;      // fingerprint of all .BMP files at the time of writing
+} index_header_t;
+
+// record of one song in the library index
+typedef struct __attribute__((packed)) {
+    char filename[SONGS_MAX_PATH_LENGTH];
+    uint32_t file_size;   // size of the .WAV file
+    uint32_t file_time;   // FAT date in the upper and time in the lower halfword
+    char name[SONGS_MAX_STRING_LENGTH];
+    char artist[SONGS_MAX_STRING_LENGTH];
+    uint8_t cover;        // 1 if the song has an album cover
+    uint32_t sample_rate; // sample rate of the pcm data
+    uint32_t data_offset; // file offset of the pcm data
+    uint32_t data_size;   // size of the pcm data in bytes
+    uint32_t samples;     // num of samples at 48 kHz
+} index_record_t;
+
 #define STRING_NOT_EQUAL(expected, str) (strncmp(str, expected, sizeof(str)) != 0)
 #define STRING_EQUAL(expected, str) (strncmp(str, expected, sizeof(str)) == 0)
 
+#define SECTOR_SIZE (_MAX_SS) // size of a sector of the SD-Card in bytes
+
 static FATFS main_fs;
 
-static int open(char *name, song_t *song);
-static int read(song_t *song, void *buffer, size_t length);
-static void skip_chunk(song_t *song, chunk_header_t *header);
-static int parse_default_header(song_t *song);
-static int parse_info_header(song_t *song);
-static int parse_data_header(song_t *song);
+/**
+ * @brief Walker over the files in all folders of the SD-Card.
+ * 
+ * Visits every file once, depth first. Instead of recursing it keeps a stack
+ * with the opened folder of every level, so walking any count of files takes
+ * the same memory. Folders deeper than SONGS_MAX_FOLDER_DEPTH are ignored.
+ */
+typedef struct {
+    DIR dirs[SONGS_MAX_FOLDER_DEPTH + 1]; // opened folder of every level, the root folder first
+    size_t depth;                         // level of the folder that is read
+    size_t length;                        // length of its path
+    char path[SONGS_MAX_PATH_LENGTH];     // path of the folder, then of the file that was found last
+} walker_t;
+
+/**
+ * @brief Long name of the file that was found last in a folder.
+ * 
+ * Songs without info are named after their file. FatFS assembles the long
+ * name in its own static working buffer, this is where it is converted into
+ * the code page. Empty if the file has only an 8.3 name.
+ */
+static char g_lfn[_MAX_LFN + 1];
+
+/**
+ * @brief Library index that was written by the last scan of the songs.
+ * 
+ * The records are in the order of the directory, so while the directory did
+ * not change every lookup hits the record after the one of the last lookup.
+ * After the scan the sorted copy of the index is opened instead, if there is
+ * one. It has the same format. Pages of the library are read by position.
+ */
+static struct {
+    FIL file;
+    uint32_t count;  // count of records, 0 if there is no valid index
+    uint32_t cursor; // record after the one that matched last
+    uint32_t covers; // fingerprint of all .BMP files the index was written with
+    int valid;       // the index holds the songs of the last scan
+    int sorted;      // the file is the sorted copy of the index
+} g_index;
+
+/**
+ * @brief Where the last listing without an index stopped.
+ * 
+ * Without an index the songs are listed from the folders. The walker is kept
+ * open after a page, so a page at or after the song it stopped at goes on from
+ * there instead of parsing every song from the first one again. Only a page
+ * before it has to walk from the start.
+ */
+static struct {
+    walker_t walker; // open while song_nr is valid
+    size_t song_nr;  // number of the song the walker finds next
+    int open;        // the walker did not reach the end of all folders
+} g_listing;
+
+/**
+ * @brief Carry buffer for streaming the pcm data.
+ * 
+ * The pcm data of a song is read in sector aligned steps. Whole sectors are
+ * read by FatFS with multi block transfers straight into the buffer of the
+ * caller. Only parts of a sector at the start of the data or at the end of a
+ * buffer go through here. What is not needed yet is kept for the next read.
+ */
+static struct {
+    uint8_t data[SECTOR_SIZE] __attribute__((aligned(4))); // word aligned for the SDIO DMA
+    song_t *song;       // song the data belongs to
+    size_t offset;      // start of the unread data
+    size_t length;      // length of the unread data
+} g_carry;
+
+/**
+ * @brief The main loop uses FatFS, maybe outside of player_lock().
+ * 
+ * Songs are opened and the library is listed while the refill of the player
+ * goes on. FatFS is not reentrant, so meanwhile the refill reads only songs
+ * that are read ahead. The others miss like an empty read ahead would.
+ */
+static __IO uint8_t g_busy;
+
+/**
+ * @brief Start of the file that is being opened.
+ * 
+ * All headers of a song are parsed from here, after one read of the first
+ * sector. Only chunks that lie beyond it are read from the file. Separate from
+ * the carry buffer, as a song is opened while another one plays.
+ */
+static struct {
+    uint8_t data[SECTOR_SIZE] __attribute__((aligned(4))); // word aligned for the SDIO DMA
+    size_t length;      // length of the valid data, less if the file is shorter
+} g_header;
+
+#if (SONGS_PREFETCH_DEPTH < 2)
+#error "SONGS_PREFETCH_DEPTH has to be at least two."
+#endif
+
+/**
+ * @brief Stream of a song that is read ahead.
+ * 
+ */
+typedef struct {
+    song_t *song;    // song of the stream, NULL if unused
+    size_t position; // stream position in the file
+    size_t next;     // file offset of the next block to read
+    uint8_t started; // song was read, before that it only gets a block to start with
+} prefetch_stream_t;
+
+/**
+ * @brief Block of read ahead pcm data.
+ * 
+ */
+typedef struct {
+    prefetch_stream_t *__IO stream; // stream the block belongs to, NULL if free
+    size_t start;                   // file offset of the first byte
+    size_t end;                     // file offset after the last byte that will be valid
+    __IO size_t length;             // valid bytes, 0 while in flight or if the read failed
+} prefetch_block_t;
+
+/**
+ * @brief Read ahead of the opened song and the queued one.
+ * 
+ * Holds blocks of the pcm data starting at the sector of the stream
+ * positions. They are read with DMA in the background, a read of a song only
+ * has to copy them. The completion interrupt only hands the block over, the
+ * next one is started by \ref songs_loop() in the main loop until every stream
+ * has its share. Every consumed block makes room for another. Starting a read
+ * talks to the card, which must not hold up the interrupts of the audio. So
+ * the reads of the songs, that run in the refill of the player, never start
+ * or wait for a block. If the block they need is not there yet, they miss and
+ * play silence instead.
+ * 
+ * Of the queued song only the first block is read until it is read itself.
+ * Then both songs are read at the same time, e.g. for a crossfade, and share
+ * the blocks. The card has no head to move, but every read costs a command
+ * and switching between files far apart on the card is slower than reading
+ * on. So the blocks of one song are read in runs until its share is full and
+ * only then the other song is read.
+ * 
+ * The sectors are looked up in the cluster link maps (fast seek) of FatFS.
+ * Every song builds its own map when it is opened, only songs whose FIL points
+ * to it are read ahead.
+ */
+static struct {
+    uint8_t data[SONGS_PREFETCH_DEPTH][SONGS_PREFETCH_BLOCK_SECTORS * SECTOR_SIZE] __attribute__((aligned(4))); // word aligned for the SDIO DMA
+    prefetch_block_t blocks[SONGS_PREFETCH_DEPTH]; // what is in the data of the same index
+    prefetch_stream_t streams[2];                  // started and queued song
+    prefetch_stream_t *last;                       // stream of the last read, is read on in runs
+    __IO uint8_t stopped;                          // no further reads are started
+    __IO uint8_t pending;                          // a block is in flight
+    __IO DRESULT result;                           // first failure of a read
+    uint8_t missed;                                // the last read ran out of read ahead data
+    uint32_t hits;                                 // reads that were served from RAM
+    uint32_t misses;                               // reads that ran out of read ahead data
+    uint32_t read_start;                           // cycle count at the start of the read in flight
+    uint64_t read_cycles;                          // cycles the card was busy with reads
+    uint64_t read_bytes;                           // bytes the card delivered in that time
+} g_prefetch;
+
+/**
+ * @brief Resamplers of the songs that are not at 48 kHz.
+ * 
+ * Two of them, so that the opened song and the queued one can be crossfaded.
+ * A song that is read without one takes the one that was not used last.
+ */
+static struct {
+    resampler_t resampler; // state of the polyphase lowpass
+    song_t *song;          // song the resampler belongs to, NULL if unused
+    size_t source_read;    // samples of the file that were written to the resampler
+} g_resample[2];
+static uint8_t g_resample_last; //!< index of the resampler that was used last
+
+/**
+ * @brief Samples of the file that are read for the resampler at once.
+ * 
+ * Word aligned for the SDIO DMA.
+ */
+static int16_t g_resample_input[2 * RESAMPLER_INPUT_SIZE] __attribute__((aligned(4)));
+
+static int list_songs(size_t first, song_info_t songs[], size_t *length);
+static int open(char *name, const char *long_name, song_t *song);
+static int next_song(walker_t *walker, song_t *song, uint32_t *record, int covers_changed, uint32_t *covers);
+static void name_from_file(song_info_t *info, const char *long_name);
+static void find_cover(song_info_t *info);
+static char *find_extension(const char *path, const char *extension);
+static int walker_open(walker_t *walker);
+static int walker_next(walker_t *walker, FILINFO *fno);
+static void walker_close(walker_t *walker);
+static uint32_t file_time(const FILINFO *fno);
+static uint32_t fingerprint(const char *path, const FILINFO *fno);
+static int index_open(const char *name);
+static int index_read(uint32_t nr, index_record_t *record);
+static int record_read(FIL *file, index_record_t *record);
+static int record_write(FIL *file, const index_record_t *record);
+static void index_pack(const song_info_t *info, index_record_t *record);
+static void index_unpack(const index_record_t *record, song_info_t *info);
+static int index_lookup(const char *path, const FILINFO *fno, song_info_t *info, uint32_t *nr);
+static int index_create(FIL *file, uint32_t copy);
+static int index_append(FIL *file, const song_info_t *info);
+static int index_finish(FIL *file, uint32_t count, uint32_t covers);
+static int index_write_header(FIL *file, uint32_t count, uint32_t covers);
+static int sort_open(uint32_t count);
+static int sort_create(void);
+static int sort_merge(const char *from, const char *to, uint32_t width);
+static int sort_compare(const index_record_t *a, const index_record_t *b);
+static int read_header(song_t *song, size_t offset, void *buffer, size_t length);
+static int read_pcm(song_t *song, int16_t *buffer, size_t *length);
+static int read_resampled(song_t *song, int16_t *buffer, size_t *length);
+static int seek_pcm(song_t *song, size_t sample);
+static int read_carried(song_t *song, uint8_t *dest, size_t bytes, size_t *done);
+static int read_prefetched(prefetch_stream_t *stream, uint8_t *dest, size_t bytes, size_t *done);
+static size_t data_end(const song_t *song);
+static int link_map(song_t *song);
+static prefetch_stream_t *stream_of(const song_t *song);
+static void prefetch_attach(prefetch_stream_t *stream, song_t *song, uint8_t started);
+static void prefetch_detach(void);
+static void prefetch_unqueue(void);
+static void prefetch_remove(prefetch_stream_t *stream);
+static void prefetch_retire(prefetch_stream_t *stream);
+static void prefetch_restart(prefetch_stream_t *stream, size_t position);
+static void prefetch_stop(void);
+static void prefetch_resume(void);
+static void prefetch_tidy(void);
+static void prefetch_fill(void);
+static prefetch_block_t *prefetch_find(const prefetch_stream_t *stream, size_t position);
+static uint32_t prefetch_resident(const prefetch_stream_t *stream);
+static uint32_t prefetch_quota(const prefetch_stream_t *stream);
+static prefetch_stream_t *prefetch_pick(void);
+static int prefetch_steal(const prefetch_stream_t *stream);
+static int prefetch_start(prefetch_stream_t *stream);
+static void prefetch_done(DRESULT res, void *context);
+static int parse_headers(song_t *song);
+static int parse_info(song_t *song, size_t offset, size_t size);
 
 int songs_init(void) {
     // initialize FatFS and mount SD-Card
@@ -62,67 +321,211 @@ int songs_init(void) {
     return (f_mount(&main_fs, "0:", 1) != FR_OK);
 }
 
-int songs_list_songs(song_t songs[], size_t *length) {
+int songs_scan_songs(size_t *length) {
     // Check parameters.
-    if (!songs || !length) {
+    if (!length) {
         return -1;
     }
-    // Open root directory to search for .wav files.
-    DIR dir;
-    if (f_opendir(&dir, "/") != FR_OK) {
-        return -1;
+    // Open the index of the last scan. Without a valid one all files are
+    // parsed.
+    if (g_index.valid) {
+        // still open from an earlier scan
+        f_close(&g_index.file);
+        g_index.valid = 0;
     }
-    // Loop over all files in the directory. Loop is not recursive,
-    // subdirectories will be ignored.
-    size_t song_nr = 0;
+    if (g_listing.open) {
+        // the folders may have changed since the last listing
+        walker_close(&g_listing.walker);
+        g_listing.open = 0;
+    }
+    int indexed = !index_open(SONGS_INDEX_FILE_NAME);
+    int covers_changed = 0;
+    int failed;
+    size_t song_nr;
     while (1) {
-        FILINFO fno;
-        if (f_readdir(&dir, &fno) != FR_OK || fno.fname[0] == 0) {
-            // exit loop on error or at end of directory content
-            break;
+        // Walk all folders for .wav files.
+        walker_t walker;
+        if (walker_open(&walker)) {
+            if (indexed) {
+                f_close(&g_index.file);
+            }
+            return -1;
         }
-        if (fno.fattrib & AM_DIR) {
-            // its a directory, ignore
-            continue;
+        // Loop over all songs. As long as every song is the same as the record
+        // at its position in the old index, nothing is written. Once one
+        // differs, a new index is started with a copy of the records up to
+        // there.
+        song_t song;
+        FIL index;
+        int writing = 0;
+        uint32_t covers = 0;
+        uint32_t record;
+        failed = 0;
+        song_nr = 0;
+        while (!next_song(&walker, &song, &record, covers_changed, &covers)) {
+            if (!writing && !failed && (!indexed || covers_changed || record != song_nr)) {
+                failed = index_create(&index, song_nr);
+                writing = !failed;
+            }
+            if (writing && index_append(&index, &song.info)) {
+                f_close(&index);
+                failed = 1;
+                writing = 0;
+            }
+            song_nr++;
         }
-        // We found a file. Check if it is a .wav file.
-        if (!strnstr(fno.fname, ".WAV", SONGS_MAX_FATFS_FILE_NAME_LENGTH)) {
-            // did not find ".wav" in filename, ignore file
-            continue;
+        // records that are left belong to deleted songs
+        if (indexed && !writing && !failed && song_nr != g_index.count) {
+            failed = index_create(&index, song_nr);
+            writing = !failed;
         }
-        // Try to open file. This parses all the wav file headers and checks the
-        // validity of the file. Invalid files will be silently skipped!
-        if (open(fno.fname, &songs[song_nr])) {
-            // could not open song or it had invalid format, ignore
+        if (indexed && !covers_changed && covers != g_index.covers) {
+            // Album covers were added or removed since the index was written.
+            // This is only known once all folders were walked, walk them again
+            // and let every song look for its cover.
+            if (writing) {
+                f_close(&index);
+            }
+            covers_changed = 1;
             continue;
         }
-        // File could be opened and header was valid. Close filesystem object as
-        // we don't want to read the audio data yet.
-        f_close(&songs[song_nr].file);
-        // If there is space for another song in the given songs array, continue
-        // loop and search for more. Otherwise exit loop and ignore all
-        // remaining files.
-        song_nr++;
-        if (song_nr >= *length) {
+        if (indexed) {
+            f_close(&g_index.file);
+        }
+        if (writing) {
+            failed = index_finish(&index, song_nr, covers);
+        }
+        break;
+    }
+    // The index is only a cache. If it can't be written, e.g. on a write
+    // protected SD-Card, the songs are listed from the folders instead.
+    // Otherwise its sorted copy stays open for the listing, which then takes
+    // no search of the folders.
+    g_index.valid = !failed && !sort_open(song_nr);
+    *length = song_nr;
+    return 0;
+}
+
+int songs_list_songs(size_t first, song_info_t songs[], size_t *length) {
+    // Check parameters.
+    if (!songs || !length) {
+        return -1;
+    }
+    g_busy = 1;
+    int ret = list_songs(first, songs, length);
+    g_busy = 0;
+    return ret;
+}
+
+static int list_songs(size_t first, song_info_t songs[], size_t *length) {
+    size_t song_nr = 0;
+    if (g_index.valid) {
+        // The index is the library, read the records of the page.
+        while (song_nr < *length && first + song_nr < g_index.count) {
+            index_record_t record;
+            if (index_read(first + song_nr, &record)) {
+                return -1;
+            }
+            index_unpack(&record, &songs[song_nr]);
+            song_nr++;
+        }
+        *length = song_nr;
+        return 0;
+    }
+    // Without an index, walk the folders like the scan did and parse every
+    // song up to the end of the page. Go on from the last listing if the page
+    // does not start before it, e.g. for the next song or page.
+    g_index.count = 0;
+    if (!g_listing.open || first < g_listing.song_nr) {
+        if (g_listing.open) {
+            walker_close(&g_listing.walker);
+        }
+        g_listing.open = !walker_open(&g_listing.walker);
+        g_listing.song_nr = 0;
+        if (!g_listing.open) {
+            return -1;
+        }
+    }
+    song_t song;
+    uint32_t record;
+    while (song_nr < *length) {
+        if (next_song(&g_listing.walker, &song, &record, 0, NULL)) {
+            // end of all folders, the walker closed them
+            g_listing.open = 0;
             break;
         }
+        if (g_listing.song_nr++ >= first) {
+            songs[song_nr++] = song.info;
+        }
     }
-    f_closedir(&dir);
     *length = song_nr;
     return 0;
 }
 
+int songs_find_song(const char *prefix, size_t *position) {
+    // Check parameters.
+    if (!prefix || !position || !g_index.valid || !g_index.sorted) {
+        return -1;
+    }
+    size_t length = strlen(prefix);
+    if (length > SONGS_MAX_STRING_LENGTH) {
+        length = SONGS_MAX_STRING_LENGTH;
+    }
+    // Search the first record whose artist does not come before the prefix.
+    uint32_t low = 0;
+    uint32_t high = g_index.count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        index_record_t record;
+        if (index_read(middle, &record)) {
+            return -1;
+        }
+        if (strncasecmp(record.artist, prefix, length) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *position = low;
+    return 0;
+}
+
 int songs_open_song(char *name, song_t *song) {
     // check parameters
     if (!name || !song) {
         return -1;
     }
-    // reset song structure
+    g_busy = 1;
+    // reset song structure (also drops the carry buffer)
     songs_close_song(song);
-    // open .wav file if it exists
-    if (open(name, song)) {
+    // Open the .wav file if it exists. Then look up all of its clusters once,
+    // which walks its chain in the FAT. A song with too many fragments for
+    // the map is read without read ahead.
+    int ret = open(name, NULL, song);
+    if (!ret) {
+        link_map(song);
+        ret = seek_pcm(song, 0);
+    }
+    g_busy = 0;
+    return ret;
+}
+
+int songs_start_song(song_t *song) {
+    // check parameters
+    if (!song || !song->file.fs) {
         return -1;
     }
+    // drop the songs that were read ahead so far, start to read ahead this one
+    prefetch_detach();
+    g_prefetch.last = NULL;
+    g_prefetch.hits = 0;
+    g_prefetch.misses = 0;
+    g_prefetch.read_cycles = 0;
+    g_prefetch.read_bytes = 0;
+    if (song->file.cltbl) {
+        prefetch_attach(&g_prefetch.streams[0], song, 1);
+    }
+    prefetch_fill();
     return 0;
 }
 
@@ -133,190 +536,1307 @@ int songs_close_song(song_t *song) {
     }
     // Clean up song structure, but don't clear the filename, could be in use by
     // the user.
+    prefetch_stream_t *stream = stream_of(song);
+    if (stream) {
+        prefetch_stop();
+        prefetch_remove(stream);
+        prefetch_resume();
+    }
     f_close(&song->file);
-    song->name[0] = '\0';
-    song->artist[0] = '\0';
-    song->bmp_name[0] = '\0';
-    song->samples = 0;
+    for (int i = 0; i < 2; ++i) {
+        if (g_resample[i].song == song) {
+            g_resample[i].song = NULL;
+        }
+    }
+    if (g_carry.song == song) {
+        g_carry.song = NULL;
+        g_carry.length = 0;
+    }
+    song->info.name[0] = '\0';
+    song->info.artist[0] = '\0';
+    song->info.bmp_name[0] = '\0';
+    song->info.samples = 0;
     song->samples_read = 0;
+    song->info.sample_rate = 0;
+    song->info.data_offset = 0;
+    song->info.data_size = 0;
     return 0;
 }
 
 int songs_read_song(song_t *song, int16_t *buffer, size_t *length) {
-    int ret = f_read(&song->file, buffer, 2 * *length, length) != FR_OK;
-    *length /= 2;
+    int ret;
+    // stop at the end of the pcm data, other chunks may follow
+    if (*length > song->info.samples - song->samples_read) {
+        *length = song->info.samples - song->samples_read;
+    }
+    size_t requested = *length;
+    g_prefetch.missed = 0;
+    if (g_busy && !stream_of(song)) {
+        // the main loop uses FatFS, which is not reentrant
+        g_prefetch.missed = 1;
+        *length = 0;
+        ret = 0;
+    } else if (song->info.sample_rate == RESAMPLER_OUTPUT_RATE) {
+        ret = read_pcm(song, buffer, length);
+    } else {
+        ret = read_resampled(song, buffer, length);
+    }
     song->samples_read += *length;
+    if (g_prefetch.missed) {
+        // The read ahead did not keep up. Fill in silence instead of waiting
+        // for the card, the song goes on where it stopped with the next read.
+        memset(buffer + *length, 0, (requested - *length) * sizeof(int16_t));
+        *length = requested;
+    }
     return ret;
 }
 
-static int open(char *name, song_t *song) {
+int songs_seek_song(song_t *song, size_t sample) {
+    if (!song || !song->file.fs) {
+        return -1;
+    }
+    if (sample > song->info.samples) {
+        sample = song->info.samples;
+    }
+    // keep left and right channel in order
+    sample -= sample % 2;
+    size_t source = sample;
+    if (song->info.sample_rate != RESAMPLER_OUTPUT_RATE) {
+        // the same point in time of the file, the resampler starts over there
+        source = 2 * ((uint64_t)(sample / 2) * song->info.sample_rate / RESAMPLER_OUTPUT_RATE);
+        for (int i = 0; i < 2; ++i) {
+            if (g_resample[i].song == song) {
+                resampler_init(&g_resample[i].resampler, song->info.sample_rate);
+                g_resample[i].source_read = source;
+            }
+        }
+    }
+    if (seek_pcm(song, source)) {
+        return -1;
+    }
+    song->samples_read = sample;
+    return 0;
+}
+
+int songs_queue_song(song_t *song) {
+    // check parameters
+    if (!song || !song->file.fs) {
+        return -1;
+    }
+    prefetch_stream_t *stream = stream_of(song);
+    if (stream && stream->started) {
+        // song is being read
+        return -1;
+    }
+    // the song that was queued before is replaced
+    prefetch_unqueue();
+    // A song that was read to its end gives its stream up here at the latest.
+    prefetch_stop();
+    prefetch_tidy();
+    // The queued song is only read ahead next to a song that is, it gets the
+    // unused stream. Otherwise or without a map of its own, it is read without
+    // read ahead.
+    prefetch_stream_t *unused = NULL;
+    int reading = 0;
+    for (int i = 0; i < 2; ++i) {
+        if (g_prefetch.streams[i].song) {
+            reading = 1;
+        } else {
+            unused = &g_prefetch.streams[i];
+        }
+    }
+    if (reading && unused && song->file.cltbl) {
+        prefetch_attach(unused, song, 0);
+    }
+    prefetch_resume();
+    return 0;
+}
+
+static int read_pcm(song_t *song, int16_t *buffer, size_t *length) {
+    size_t done = 0;
+    int ret;
+    prefetch_stream_t *stream = stream_of(song);
+    if (stream) {
+        ret = read_prefetched(stream, (uint8_t *)buffer, 2 * *length, &done);
+    } else {
+        ret = read_carried(song, (uint8_t *)buffer, 2 * *length, &done);
+    }
+    *length = done / 2;
+    return ret;
+}
+
+static int read_resampled(song_t *song, int16_t *buffer, size_t *length) {
+    int i = (g_resample[0].song == song) ? 0 : (g_resample[1].song == song) ? 1 : !g_resample_last;
+    g_resample_last = i;
+    resampler_t *resampler = &g_resample[i].resampler;
+    if (g_resample[i].song != song) {
+        // Take over the resampler. Unless the song is read from its start, the
+        // file continues where the output is.
+        g_resample[i].song = song;
+        g_resample[i].source_read = 2 * ((uint64_t)(song->samples_read / 2) * song->info.sample_rate / RESAMPLER_OUTPUT_RATE);
+        resampler_init(resampler, song->info.sample_rate);
+        if (song->samples_read && seek_pcm(song, g_resample[i].source_read)) {
+            *length = 0;
+            return -1;
+        }
+    }
+    // the file holds whole stereo samples only
+    size_t source_samples = song->info.data_size / 4 * 2;
+    size_t done = 0;
+    int ret = 0;
+    while (1) {
+        done += resampler_read(resampler, buffer + done, *length - done);
+        if (done >= *length || ret || g_prefetch.missed) {
+            break;
+        }
+        // the resampler needs more of the file
+        size_t n = resampler_space(resampler);
+        if (n > 2 * RESAMPLER_INPUT_SIZE) {
+            n = 2 * RESAMPLER_INPUT_SIZE;
+        }
+        size_t left = source_samples - g_resample[i].source_read;
+        if (!left) {
+            // flush the lowpass with silence after the end
+            resampler_write(resampler, NULL, n);
+            continue;
+        }
+        if (n > left) {
+            n = left;
+        }
+        ret = read_pcm(song, g_resample_input, &n);
+        if (!n) {
+            // the file is shorter than its header says, or the read ahead ran
+            // dry
+            break;
+        }
+        g_resample[i].source_read += resampler_write(resampler, g_resample_input, n);
+    }
+    *length = done;
+    return ret;
+}
+
+static int seek_pcm(song_t *song, size_t sample) {
+    size_t position = song->info.data_offset + 2 * sample;
+    prefetch_stream_t *stream = stream_of(song);
+    if (stream) {
+        // the link map already knows where the data is, just read ahead anew
+        prefetch_restart(stream, position);
+    } else {
+        if (f_lseek(&song->file, position) != FR_OK) {
+            return -1;
+        }
+        if (g_carry.song == song) {
+            g_carry.length = 0;
+        }
+    }
+    return 0;
+}
+
+static int open(char *name, const char *long_name, song_t *song) {
     // save filename into structure
-    strncpy(song->filename, name, SONGS_MAX_FATFS_FILE_NAME_LENGTH - 1);
+    strncpy(song->info.filename, name, SONGS_MAX_PATH_LENGTH - 1);
     // open .wav file if it exists
-    if (f_open(&song->file, song->filename, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+    if (f_open(&song->file, song->info.filename, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
         return -1;
     }
     // The wav file is open, now read and validate the file headers. First comes
     // the default RIFF and WAV format header, then the optional LIST INFO
     // header and last the actual data header after which the raw pcm stream is.
-    if (parse_default_header(song)) {
+    if (parse_headers(song)) {
         return -1;
     }
-    if (parse_info_header(song)) {
-        // song info was not present or not valid, set to unknown
-        strncpy(song->artist, "Unknown", SONGS_MAX_STRING_LENGTH);
-        strncpy(song->name, "Unknown", SONGS_MAX_STRING_LENGTH);
+    // Song info that is not present or not valid is filled in. E.g. ffmpeg
+    // writes a LIST INFO with only the software in it.
+    if (!song->info.artist[0]) {
+        strncpy(song->info.artist, "Unknown", SONGS_MAX_STRING_LENGTH);
     }
-    if (parse_data_header(song)) {
-        return -1;
+    if (!song->info.name[0]) {
+        // name the song after its file
+        name_from_file(&song->info, long_name);
     }
+    find_cover(&song->info);
+    return 0;
+}
+
+static int next_song(walker_t *walker, song_t *song, uint32_t *record, int covers_changed, uint32_t *covers) {
+    FILINFO fno;
+    while (!walker_next(walker, &fno)) {
+        // We found a file. Album covers are only counted, as the song does
+        // not change when one is added or removed. Their fingerprints are
+        // summed up, so the order of the folders does not matter.
+        if (covers && find_extension(walker->path, ".BMP")) {
+            *covers += fingerprint(walker->path, &fno);
+            continue;
+        }
+        // Check if it is a .wav file.
+        if (!find_extension(walker->path, ".WAV")) {
+            // did not find ".wav" in filename, ignore file
+            continue;
+        }
+        // Take the song from the index if the file did not change since.
+        if (g_index.count && !index_lookup(walker->path, &fno, &song->info, record)) {
+            if (covers_changed) {
+                find_cover(&song->info);
+            }
+            return 0;
+        }
+        *record = UINT32_MAX;
+        // Try to open file. This parses all the wav file headers and checks the
+        // validity of the file. Invalid files will be silently skipped! Close
+        // filesystem object right away as we don't want to read the audio data
+        // yet.
+        memset(&song->info, 0, sizeof(song_info_t));
+        int invalid = open(walker->path, g_lfn, song);
+        f_close(&song->file);
+        if (invalid) {
+            continue;
+        }
+        song->info.file_size = fno.fsize;
+        song->info.file_time = file_time(&fno);
+        return 0;
+    }
+    // exit loop on error or at end of all folders
+    return -1;
+}
+
+static void name_from_file(song_info_t *info, const char *long_name) {
+    // The 8.3 name of the file is the last part of its path.
+    const char *name = strrchr(info->filename, '/');
+    name = name ? name + 1 : info->filename;
+    if (!long_name) {
+        // Search the long name in the folder of the file. The path is only
+        // given by the 8.3 names, FatFS does not look it up then.
+        char folder[SONGS_MAX_PATH_LENGTH] = "/";
+        if (name != info->filename) {
+            memcpy(folder, info->filename, name - 1 - info->filename);
+            folder[name - 1 - info->filename] = '\0';
+        }
+        DIR dir;
+        FILINFO fno;
+        fno.lfname = g_lfn;
+        fno.lfsize = sizeof(g_lfn);
+        int found = 0;
+        if (f_opendir(&dir, folder) == FR_OK) {
+            while (!found && f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != 0) {
+                found = !strcasecmp(name, fno.fname) || !strcasecmp(name, g_lfn);
+            }
+            f_closedir(&dir);
+        }
+        if (!found) {
+            g_lfn[0] = '\0';
+        }
+        long_name = g_lfn;
+    }
+    // Take the long name if the file has one, without its extension.
+    if (long_name[0]) {
+        name = long_name;
+    }
+    const char *file_extension = strrchr(name, '.');
+    size_t length = file_extension ? (size_t)(file_extension - name) : strlen(name);
+    if (length > SONGS_MAX_STRING_LENGTH - 1) {
+        length = SONGS_MAX_STRING_LENGTH - 1;
+    }
+    memcpy(info->name, name, length);
+    info->name[length] = '\0';
+}
+
+static void find_cover(song_info_t *info) {
     // look for album cover
-    strncpy(song->bmp_name, song->filename, SONGS_MAX_FATFS_FILE_NAME_LENGTH);
-    char *file_extension = strnstr(song->bmp_name, ".WAV", SONGS_MAX_FATFS_FILE_NAME_LENGTH);
+    strncpy(info->bmp_name, info->filename, SONGS_MAX_PATH_LENGTH);
+    char *file_extension = find_extension(info->bmp_name, ".WAV");
     if (file_extension) {
         strcpy(file_extension, ".BMP");
         // try to open album
         FIL bmp;
-        if (f_open(&bmp, song->bmp_name, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+        if (f_open(&bmp, info->bmp_name, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
             // cover does not exist
-            song->bmp_name[0] = '\0';
+            info->bmp_name[0] = '\0';
         }
         f_close(&bmp);
     }
+}
+
+static char *find_extension(const char *path, const char *extension) {
+    // The 8.3 names can be in lower case, e.g. "song.wav" as Windows writes it.
+    size_t length = strlen(path);
+    size_t extension_length = strlen(extension);
+    if (length < extension_length || strcasecmp(path + length - extension_length, extension)) {
+        return NULL;
+    }
+    return (char *)path + length - extension_length;
+}
+
+static int walker_open(walker_t *walker) {
+    walker->depth = 0;
+    walker->length = 0;
+    walker->path[0] = '\0';
+    return (f_opendir(&walker->dirs[0], "/") != FR_OK);
+}
+
+static int walker_next(walker_t *walker, FILINFO *fno) {
+    // Paths are built from the 8.3 names, their length is bounded. The long
+    // names are only kept of the file that was found last.
+    fno->lfname = g_lfn;
+    fno->lfsize = sizeof(g_lfn);
+    while (1) {
+        // drop the file that was found last from the path
+        walker->path[walker->length] = '\0';
+        if (f_readdir(&walker->dirs[walker->depth], fno) != FR_OK || fno->fname[0] == 0) {
+            // Error or end of the folder, continue in the one above.
+            f_closedir(&walker->dirs[walker->depth]);
+            if (walker->depth == 0) {
+                return -1;
+            }
+            walker->depth--;
+            char *slash = strrchr(walker->path, '/');
+            walker->length = slash ? (size_t)(slash - walker->path) : 0;
+            continue;
+        }
+        if (fno->fname[0] == '.' || g_lfn[0] == '.' || (fno->fattrib & (AM_HID | AM_SYS))) {
+            // ignore "." and "..", hidden files and e.g. "System Volume Information"
+            continue;
+        }
+        size_t length = walker->length + (walker->length ? 1 : 0) + strlen(fno->fname);
+        if (length > SONGS_MAX_PATH_LENGTH - 1) {
+            continue;
+        }
+        if (walker->length) {
+            walker->path[walker->length] = '/';
+            strcpy(walker->path + walker->length + 1, fno->fname);
+        } else {
+            strcpy(walker->path, fno->fname);
+        }
+        if (!(fno->fattrib & AM_DIR)) {
+            return 0;
+        }
+        // Its a folder, continue in it. Too deep ones are ignored.
+        if (walker->depth < SONGS_MAX_FOLDER_DEPTH &&
+            f_opendir(&walker->dirs[walker->depth + 1], walker->path) == FR_OK) {
+            walker->depth++;
+            walker->length = length;
+        }
+    }
+}
+
+static void walker_close(walker_t *walker) {
+    // close the folders that are still open, if the walk did not end
+    for (size_t i = 0; i <= walker->depth; ++i) {
+        f_closedir(&walker->dirs[i]);
+    }
+}
+
+static uint32_t file_time(const FILINFO *fno) {
+    return ((uint32_t)fno->fdate << 16) | fno->ftime;
+}
+
+static uint32_t fingerprint(const char *path, const FILINFO *fno) {
+    // FNV-1a hash over path, size and timestamp.
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < SONGS_MAX_PATH_LENGTH && path[i]; ++i) {
+        hash = (hash ^ (uint8_t)path[i]) * 16777619U;
+    }
+    hash = (hash ^ fno->fsize) * 16777619U;
+    hash = (hash ^ file_time(fno)) * 16777619U;
+    return hash;
+}
+
+static int index_open(const char *name) {
+    g_index.count = 0;
+    g_index.cursor = 0;
+    g_index.sorted = 0;
+    if (f_open(&g_index.file, name, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+        return -1;
+    }
+    // An index of another version or one that was not written completely is
+    // not valid. The records must fill the rest of the file.
+    index_header_t header = {0};
+    UINT read_bytes = 0;
+    f_read(&g_index.file, &header, sizeof(index_header_t), &read_bytes);
+    if (read_bytes != sizeof(index_header_t) ||
+        STRING_NOT_EQUAL("SIDX", header.magic) ||
+        header.version != INDEX_VERSION ||
+        header.record_size != sizeof(index_record_t) ||
+        f_size(&g_index.file) != sizeof(index_header_t) + header.count * sizeof(index_record_t)) {
+        f_close(&g_index.file);
+        return -1;
+    }
+    g_index.count = header.count;
+    g_index.covers = header.covers;
     return 0;
 }
 
-static int read(song_t *song, void *buffer, size_t length) {
-    size_t read_bytes = 0;
-    f_read(&song->file, buffer, length, &read_bytes);
-    return (read_bytes != length);
+static int index_read(uint32_t nr, index_record_t *record) {
+    if (f_lseek(&g_index.file, sizeof(index_header_t) + nr * sizeof(index_record_t)) != FR_OK) {
+        return -1;
+    }
+    return record_read(&g_index.file, record);
 }
 
-static void skip_chunk(song_t *song, chunk_header_t *header) {
-    // If a chunk has an uneven length it is padded with an extra zero byte. So
-    // do also skip over one byte extra if chunk_size is uneven.
-    header->chunk_size += header->chunk_size % 2;
-    f_lseek(&song->file, song->file.fptr + header->chunk_size);
+static int record_read(FIL *file, index_record_t *record) {
+    UINT read_bytes = 0;
+    if (f_read(file, record, sizeof(index_record_t), &read_bytes) != FR_OK) {
+        return -1;
+    }
+    return (read_bytes != sizeof(index_record_t));
 }
 
-static int parse_default_header(song_t *song) {
-    // read chunk header for whole file
-    //  - should be of id "RIFF"
-    chunk_header_t header = {0};
-    if (read(song, &header, sizeof(chunk_header_t)) ||
-        STRING_NOT_EQUAL("RIFF", header.chunk_id)) {
+static int record_write(FIL *file, const index_record_t *record) {
+    UINT written = 0;
+    if (f_write(file, record, sizeof(index_record_t), &written) != FR_OK) {
         return -1;
     }
+    return (written != sizeof(index_record_t));
+}
+
+static void index_pack(const song_info_t *info, index_record_t *record) {
+    memset(record, 0, sizeof(index_record_t));
+    strncpy(record->filename, info->filename, SONGS_MAX_PATH_LENGTH - 1);
+    strncpy(record->name, info->name, SONGS_MAX_STRING_LENGTH - 1);
+    strncpy(record->artist, info->artist, SONGS_MAX_STRING_LENGTH - 1);
+    record->file_size = info->file_size;
+    record->file_time = info->file_time;
+    record->cover = (info->bmp_name[0] != '\0');
+    record->sample_rate = info->sample_rate;
+    record->data_offset = info->data_offset;
+    record->data_size = info->data_size;
+    record->samples = info->samples;
+}
+
+static void index_unpack(const index_record_t *record, song_info_t *info) {
+    // Fill the info like open() would. The strings of the record are not
+    // trusted to be terminated.
+    memset(info, 0, sizeof(song_info_t));
+    strncpy(info->filename, record->filename, SONGS_MAX_PATH_LENGTH - 1);
+    strncpy(info->name, record->name, SONGS_MAX_STRING_LENGTH - 1);
+    strncpy(info->artist, record->artist, SONGS_MAX_STRING_LENGTH - 1);
+    char *file_extension = find_extension(info->filename, ".WAV");
+    if (record->cover && file_extension) {
+        strncpy(info->bmp_name, info->filename, SONGS_MAX_PATH_LENGTH);
+        strcpy(info->bmp_name + (file_extension - info->filename), ".BMP");
+    }
+    info->samples = record->samples;
+    info->sample_rate = record->sample_rate;
+    info->data_offset = record->data_offset;
+    info->data_size = record->data_size;
+    info->file_size = record->file_size;
+    info->file_time = record->file_time;
+}
+
+static int index_lookup(const char *path, const FILINFO *fno, song_info_t *info, uint32_t *nr) {
+    // Search the record of the file, starting after the one that matched last.
+    for (uint32_t i = 0; i < g_index.count; ++i) {
+        uint32_t n = (g_index.cursor + i) % g_index.count;
+        index_record_t record;
+        if (index_read(n, &record)) {
+            return -1;
+        }
+        if (STRING_NOT_EQUAL(path, record.filename)) {
+            continue;
+        }
+        g_index.cursor = n + 1;
+        if (record.file_size != fno->fsize || record.file_time != file_time(fno)) {
+            // file was changed, parse it again
+            return -1;
+        }
+        index_unpack(&record, info);
+        *nr = n;
+        return 0;
+    }
+    return -1;
+}
+
+static int index_create(FIL *file, uint32_t copy) {
+    // The new index is written next to the old one and only replaces it once
+    // it is complete, e.g. if the power is cut while writing.
+    if (f_open(file, INDEX_TEMP_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        return -1;
+    }
+    // The header is written last, reserve space for it.
+    index_header_t header = {0};
+    UINT written = 0;
+    int ret = (f_write(file, &header, sizeof(index_header_t), &written) != FR_OK ||
+               written != sizeof(index_header_t));
+    // copy the records of the songs that did not change
+    for (uint32_t i = 0; i < copy && !ret; ++i) {
+        index_record_t record;
+        ret = (index_read(i, &record) || record_write(file, &record));
+    }
+    if (ret) {
+        f_close(file);
+    }
+    return ret;
+}
+
+static int index_append(FIL *file, const song_info_t *info) {
+    index_record_t record;
+    index_pack(info, &record);
+    return record_write(file, &record);
+}
+
+static int index_finish(FIL *file, uint32_t count, uint32_t covers) {
+    int ret = index_write_header(file, count, covers);
+    if ((f_close(file) != FR_OK) || ret) {
+        return -1;
+    }
+    // Replace the old index. Its sorted copy goes first, so that it is never
+    // older than the index.
+    FRESULT res = f_unlink(SONGS_SORTED_FILE_NAME);
+    if (res != FR_OK && res != FR_NO_FILE) {
+        return -1;
+    }
+    res = f_unlink(SONGS_INDEX_FILE_NAME);
+    if ((res != FR_OK && res != FR_NO_FILE) ||
+        f_rename(INDEX_TEMP_FILE_NAME, SONGS_INDEX_FILE_NAME) != FR_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+static int index_write_header(FIL *file, uint32_t count, uint32_t covers) {
+    index_header_t header = {.magic = {'S', 'I', 'D', 'X'},
+                             .version = INDEX_VERSION,
+                             .record_size = sizeof(index_record_t),
+                             .count = count,
+                             .covers = covers};
+    UINT written = 0;
+    if (f_lseek(file, 0) != FR_OK ||
+        f_write(file, &header, sizeof(index_header_t), &written) != FR_OK) {
+        return -1;
+    }
+    return (written != sizeof(index_header_t));
+}
+
+static int sort_open(uint32_t count) {
+    // Take the sorted copy if it was written after the index.
+    if (!index_open(SONGS_SORTED_FILE_NAME)) {
+        if (g_index.count == count) {
+            g_index.sorted = 1;
+            return 0;
+        }
+        f_close(&g_index.file);
+    }
+    // Sort the index once, it is read while the copy is written.
+    if (index_open(SONGS_INDEX_FILE_NAME)) {
+        return -1;
+    }
+    int ret = sort_create();
+    f_close(&g_index.file);
+    if (!ret && !index_open(SONGS_SORTED_FILE_NAME)) {
+        g_index.sorted = 1;
+        return 0;
+    }
+    // can't be sorted, list the songs in the order of the folders
+    return index_open(SONGS_INDEX_FILE_NAME);
+}
+
+static int sort_create(void) {
+    // Bottom-up merge sort on the SD-Card, every pass writes a new file. The
+    // first pass sorts runs of the index in RAM, every further pass merges
+    // two runs into one of double length until one run is left. The records
+    // are only read and written in order, and only a few are in RAM at once.
+    const char *names[2] = {INDEX_TEMP_FILE_NAME, SORT_TEMP_FILE_NAME};
+    FIL out;
+    if (f_open(&out, names[0], FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        return -1;
+    }
+    int ret = index_write_header(&out, g_index.count, g_index.covers);
+    for (uint32_t start = 0; start < g_index.count && !ret; start += SORT_RUN_LENGTH) {
+        // insertion sort, records with the same key keep their order
+        index_record_t run[SORT_RUN_LENGTH];
+        uint32_t length = g_index.count - start;
+        if (length > SORT_RUN_LENGTH) {
+            length = SORT_RUN_LENGTH;
+        }
+        for (uint32_t i = 0; i < length && !ret; ++i) {
+            index_record_t record;
+            ret = index_read(start + i, &record);
+            if (ret) {
+                break;
+            }
+            uint32_t j = i;
+            for (; j > 0 && sort_compare(&run[j - 1], &record) > 0; --j) {
+                run[j] = run[j - 1];
+            }
+            run[j] = record;
+        }
+        for (uint32_t i = 0; i < length && !ret; ++i) {
+            ret = record_write(&out, &run[i]);
+        }
+    }
+    if (f_close(&out) != FR_OK) {
+        ret = -1;
+    }
+    int from = 0;
+    for (uint32_t width = SORT_RUN_LENGTH; width < g_index.count && !ret; width *= 2) {
+        ret = sort_merge(names[from], names[!from], width);
+        from = !from;
+    }
+    // replace the old sorted copy, drop the runs
+    if (!ret) {
+        FRESULT res = f_unlink(SONGS_SORTED_FILE_NAME);
+        ret = ((res != FR_OK && res != FR_NO_FILE) ||
+               f_rename(names[from], SONGS_SORTED_FILE_NAME) != FR_OK);
+    }
+    f_unlink(names[!from]);
+    if (ret) {
+        f_unlink(names[from]);
+    }
+    return ret;
+}
+
+static int sort_merge(const char *from, const char *to, uint32_t width) {
+    // Two readers of the same file, one at each run.
+    FIL in[2];
+    FIL out;
+    if (f_open(&in[0], from, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+        return -1;
+    }
+    if (f_open(&in[1], from, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+        f_close(&in[0]);
+        return -1;
+    }
+    if (f_open(&out, to, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        f_close(&in[0]);
+        f_close(&in[1]);
+        return -1;
+    }
+    int ret = index_write_header(&out, g_index.count, g_index.covers);
+    for (uint32_t start = 0; start < g_index.count && !ret; start += 2 * width) {
+        // Merge the run at start with the one that follows, the last one may
+        // be shorter or missing.
+        uint32_t rest = g_index.count - start;
+        uint32_t left[2];
+        left[0] = (rest > width) ? width : rest;
+        left[1] = (rest - left[0] > width) ? width : rest - left[0];
+        index_record_t record[2];
+        for (int i = 0; i < 2 && !ret; ++i) {
+            ret = (f_lseek(&in[i], sizeof(index_header_t) + (start + i * width) * sizeof(index_record_t)) != FR_OK ||
+                   (left[i] && record_read(&in[i], &record[i])));
+        }
+        while (!ret && (left[0] || left[1])) {
+            // on the same key the first run goes first, the sort is stable
+            int i = !left[0] || (left[1] && sort_compare(&record[1], &record[0]) < 0);
+            ret = record_write(&out, &record[i]);
+            if (!ret && --left[i]) {
+                ret = record_read(&in[i], &record[i]);
+            }
+        }
+    }
+    if (f_close(&out) != FR_OK) {
+        ret = -1;
+    }
+    f_close(&in[0]);
+    f_close(&in[1]);
+    return ret;
+}
+
+static int sort_compare(const index_record_t *a, const index_record_t *b) {
+    // by artist, then by title, both without regard to their case
+    int diff = strncasecmp(a->artist, b->artist, SONGS_MAX_STRING_LENGTH);
+    if (diff) {
+        return diff;
+    }
+    return strncasecmp(a->name, b->name, SONGS_MAX_STRING_LENGTH);
+}
+
+static int read_header(song_t *song, size_t offset, void *buffer, size_t length) {
+    // Check against the size of the file first, the sizes of the chunks are
+    // not trusted. Only parts beyond the first sector are read from the file.
+    size_t file_size = f_size(&song->file);
+    if (offset > file_size || length > file_size - offset) {
+        return -1;
+    }
+    if (offset + length <= g_header.length) {
+        memcpy(buffer, g_header.data + offset, length);
+        return 0;
+    }
+    UINT read_bytes = 0;
+    if (f_lseek(&song->file, offset) != FR_OK ||
+        f_read(&song->file, buffer, length, &read_bytes) != FR_OK) {
+        return -1;
+    }
+    return (read_bytes != length);
+}
+
+static int parse_headers(song_t *song) {
+    // Read the first sector at once, the headers are parsed from the buffer.
+    UINT read_bytes = 0;
+    g_header.length = 0;
+    if (f_read(&song->file, g_header.data, SECTOR_SIZE, &read_bytes) != FR_OK) {
+        return -1;
+    }
+    g_header.length = read_bytes;
+    // chunk header for whole file
+    //  - should be of id "RIFF"
     // chunk data for id "RIFF"
     //  - should be just "WAVE"
+    chunk_header_t header = {0};
     riff_chunk_t riff = {0};
-    if (read(song, &riff, sizeof(riff_chunk_t)) ||
+    size_t offset = 0;
+    if (read_header(song, offset, &header, sizeof(chunk_header_t)) ||
+        STRING_NOT_EQUAL("RIFF", header.chunk_id) ||
+        read_header(song, offset + sizeof(chunk_header_t), &riff, sizeof(riff_chunk_t)) ||
         STRING_NOT_EQUAL("WAVE", riff.format)) {
         return -1;
     }
-    // read chunk header for format
+    offset += sizeof(chunk_header_t) + sizeof(riff_chunk_t);
+    // chunk header for format
     //  - should be of id "fmt "
     //  - should have a size of 16 bytes
-    if (read(song, &header, sizeof(chunk_header_t)) ||
-        STRING_NOT_EQUAL("fmt ", header.chunk_id) ||
-        header.chunk_size != sizeof(fmt_chunk_t)) {
-        return -1;
-    }
     // chunk data for id "fmt ", should have:
     // - 16 bits depth
-    // - 48 kHz sample rate
+    // - 48 kHz sample rate, or one the resampler converts from
     // - stereo channel
     // - uncompressed pcm encoding
     fmt_chunk_t fmt = {0};
-    if (read(song, &fmt, sizeof(fmt_chunk_t)) ||
+    if (read_header(song, offset, &header, sizeof(chunk_header_t)) ||
+        STRING_NOT_EQUAL("fmt ", header.chunk_id) ||
+        header.chunk_size != sizeof(fmt_chunk_t) ||
+        read_header(song, offset + sizeof(chunk_header_t), &fmt, sizeof(fmt_chunk_t)) ||
         fmt.audio_format != 1 ||
         fmt.num_channels != 2 ||
-        fmt.sample_rate != 48000 ||
+        (fmt.sample_rate != RESAMPLER_OUTPUT_RATE && !resampler_supports(fmt.sample_rate)) ||
         fmt.bits_per_sample != 16) {
         return -1;
     }
-    return 0;
-}
-
-static int parse_info_header(song_t *song) {
-    // read chunk header for list info (and skip unknown chunks if neccessary)
-    //  - should be of id "LIST"
-    chunk_header_t header = {0};
+    song->info.sample_rate = fmt.sample_rate;
+    offset += sizeof(chunk_header_t) + sizeof(fmt_chunk_t);
+    // Walk the chunks up to the one of id "data". The song info is in a chunk
+    // of id "LIST" in front of it, unknown chunks are skipped.
+    size_t file_size = f_size(&song->file);
     while (1) {
-        if (read(song, &header, sizeof(chunk_header_t)) ||
-            header.chunk_size == 0) {
-            // failed to read data
+        if (read_header(song, offset, &header, sizeof(chunk_header_t))) {
+            // there is no pcm data
             return -1;
         }
-        if (STRING_NOT_EQUAL("LIST", header.chunk_id)) {
-            // this chunk is unknown, skip it
-            skip_chunk(song, &header);
-            continue;
-        } else {
-            // header was found, stop loop
+        offset += sizeof(chunk_header_t);
+        size_t left = file_size - offset;
+        if (STRING_EQUAL("data", header.chunk_id)) {
             break;
         }
+        if (header.chunk_size > left) {
+            // chunk claims more than the file holds
+            return -1;
+        }
+        if (STRING_EQUAL("LIST", header.chunk_id)) {
+            // a LIST of another format or a broken one is skipped
+            parse_info(song, offset, header.chunk_size);
+        }
+        // If a chunk has an uneven length it is padded with an extra zero
+        // byte. So do also skip over one byte extra if chunk_size is uneven.
+        offset += header.chunk_size;
+        if (header.chunk_size % 2 && offset < file_size) {
+            offset++;
+        }
+    }
+    // The data chunk may claim more than the file holds if the file was cut
+    // off, data_end() stops at the end of the file then.
+    if (header.chunk_size == 0) {
+        return -1;
+    }
+    // The song is played at 48 kHz, count the samples it has then.
+    song->info.data_size = header.chunk_size;
+    song->info.samples = header.chunk_size / 2;
+    if (song->info.sample_rate != RESAMPLER_OUTPUT_RATE) {
+        song->info.samples = 2 * ((uint64_t)(header.chunk_size / 4) * RESAMPLER_OUTPUT_RATE / song->info.sample_rate);
     }
+    // What follows is just the raw pcm bitstream. The file pointer is only
+    // placed there once the song is read, a scan closes the file right away.
+    song->info.data_offset = offset;
+    return 0;
+}
+
+static int parse_info(song_t *song, size_t offset, size_t size) {
     // chunk data for id "LIST"
     //  - should be just "INFO"
     list_chunk_t list = {0};
-    if (read(song, &list, sizeof(list_chunk_t)) ||
+    if (size < sizeof(list_chunk_t) ||
+        read_header(song, offset, &list, sizeof(list_chunk_t)) ||
         STRING_NOT_EQUAL("INFO", list.format)) {
         return -1;
     }
-    // read chunk header of info (and skip unknown chunks if neccessary)
-    //  - should be "IART" (name of artist)
-    //  - or should be "INAM" (name of song)
-    while (1) {
-        if (read(song, &header, sizeof(chunk_header_t)) ||
-            header.chunk_size == 0) {
-            // failed to read data
+    size_t end = offset + size;
+    offset += sizeof(list_chunk_t);
+    // chunk headers of the info (and skip unknown chunks)
+    //  - "IART" (name of artist)
+    //  - "INAM" (name of song)
+    while (end - offset >= sizeof(chunk_header_t)) {
+        chunk_header_t header = {0};
+        if (read_header(song, offset, &header, sizeof(chunk_header_t))) {
+            return -1;
+        }
+        offset += sizeof(chunk_header_t);
+        if (header.chunk_size > end - offset) {
+            // chunk claims more than the list holds
             return -1;
         }
         if (STRING_EQUAL("IART", header.chunk_id) || STRING_EQUAL("INAM", header.chunk_id)) {
-            // wo got the name of the artist or of the song, save it
-            char temp[header.chunk_size];
-            read(song, temp, header.chunk_size);
-            char *dest = (header.chunk_id[1] == 'A') ? song->artist : song->name;
-            strncpy(dest, temp, SONGS_MAX_STRING_LENGTH);
-            dest[SONGS_MAX_STRING_LENGTH - 1] = '\0';
-            if (header.chunk_size % 2) {
-                f_lseek(&song->file, song->file.fptr + 1);
+            // We got the name of the artist or of the song, save it. It is not
+            // necessarily terminated within the chunk.
+            char *dest = (header.chunk_id[1] == 'A') ? song->info.artist : song->info.name;
+            size_t length = (header.chunk_size < SONGS_MAX_STRING_LENGTH - 1) ? header.chunk_size
+                                                                            : SONGS_MAX_STRING_LENGTH - 1;
+            if (read_header(song, offset, dest, length)) {
+                return -1;
             }
-        } else if (STRING_EQUAL("data", header.chunk_id)) {
-            // We went too far and reached the end of the info chunk. The next
-            // chunk is already the pcm data. Rewind the filepointer and exit.
-            f_lseek(&song->file, song->file.fptr - sizeof(chunk_header_t));
-            break;
-        } else {
-            // this chunk is unknown, skip it
-            skip_chunk(song, &header);
+            dest[length] = '\0';
+        }
+        offset += header.chunk_size;
+        if (header.chunk_size % 2 && offset < end) {
+            offset++;
         }
     }
     return 0;
 }
 
-static int parse_data_header(song_t *song) {
-    // read chunk header for data (and skip unknown chunks if neccessary)
-    //  - should be of id "data"
-    chunk_header_t header = {0};
-    while (1) {
-        if (read(song, &header, sizeof(chunk_header_t)) ||
-            header.chunk_size == 0) {
-            // failed to read data
-            return -1;
+static int read_carried(song_t *song, uint8_t *dest, size_t bytes, size_t *done) {
+    int ret = 0;
+    if (g_carry.song != song) {
+        // The carried data is of another song, e.g. while two songs are
+        // crossfaded. Hand it back to its song, it reads it again next time.
+        if (g_carry.song && g_carry.length) {
+            f_lseek(&g_carry.song->file, g_carry.song->file.fptr - g_carry.length);
         }
-        if (STRING_NOT_EQUAL("data", header.chunk_id)) {
-            // this chunk is unknown, skip it
-            skip_chunk(song, &header);
+        g_carry.song = song;
+        g_carry.length = 0;
+    }
+    while (*done < bytes) {
+        if (g_carry.length) {
+            // rest of a sector that was read before
+            size_t n = (g_carry.length < bytes - *done) ? g_carry.length : bytes - *done;
+            memcpy(dest + *done, g_carry.data + g_carry.offset, n);
+            g_carry.offset += n;
+            g_carry.length -= n;
+            *done += n;
             continue;
+        }
+        UINT read = 0;
+        size_t misalignment = song->file.fptr % SECTOR_SIZE;
+        size_t remaining = bytes - *done;
+        if (!misalignment && remaining >= SECTOR_SIZE) {
+            // Whole sectors, FatFS reads them straight into the buffer. (If the
+            // pcm data does not start at a multiple of four bytes, the driver
+            // has to fall back to single block reads as the buffer is not word
+            // aligned anymore.)
+            ret = f_read(&song->file, dest + *done, remaining - remaining % SECTOR_SIZE, &read) != FR_OK;
+            *done += read;
         } else {
-            // header was found, stop loop
+            // Part of a sector. Read only up to the end of the sector, so that
+            // the file pointer is aligned for the next read.
+            ret = f_read(&song->file, g_carry.data, SECTOR_SIZE - misalignment, &read) != FR_OK;
+            g_carry.offset = 0;
+            g_carry.length = read;
+        }
+        if (ret || !read) {
+            // failed or end of file
             break;
         }
     }
-    song->samples = header.chunk_size / 2;
-    // File pointer is now at the end of all headers, what follows is just the
-    // raw pcm bitstream.
+    return ret;
+}
+
+static int read_prefetched(prefetch_stream_t *stream, uint8_t *dest, size_t bytes, size_t *done) {
+    size_t end = data_end(stream->song);
+    // from now on the song gets its share of the blocks
+    stream->started = 1;
+    if (g_prefetch.result != RES_OK) {
+        // A read failed. Its block is dropped and read again by songs_loop().
+        g_prefetch.result = RES_OK;
+        return -1;
+    }
+    // Find out how much is read ahead first. The blocks only grow meanwhile,
+    // the interrupt hands over the ones in flight.
+    size_t wanted = bytes - *done;
+    size_t available = 0;
+    prefetch_block_t *block;
+    while (available < wanted && (block = prefetch_find(stream, stream->position + available))) {
+        available = block->start + block->length - stream->position;
+    }
+    if (available < wanted && stream->position + available < end) {
+        // The rest is still being read from the card, or was not started yet.
+        // This runs in the refill of the player, which must neither wait for
+        // the card nor talk to it. The rest is a miss, songs_loop() catches
+        // up. Only whole stereo samples are taken, or the channels of what
+        // follows would be swapped.
+        g_prefetch.missed = 1;
+        g_prefetch.misses++;
+        wanted = available - available % 4;
+    } else {
+        g_prefetch.hits++;
+    }
+    while (wanted && (block = prefetch_find(stream, stream->position))) {
+        size_t block_end = block->start + block->length;
+        size_t n = (block_end - stream->position < wanted) ? block_end - stream->position : wanted;
+        memcpy(dest + *done, g_prefetch.data[block - g_prefetch.blocks] + (stream->position - block->start), n);
+        stream->position += n;
+        *done += n;
+        wanted -= n;
+        if (stream->position >= block_end) {
+            // block is used up, make room for the next
+            block->stream = NULL;
+        }
+    }
+    return 0;
+}
+
+static size_t data_end(const song_t *song) {
+    // the data chunk may claim more than the file holds
+    size_t end = song->info.data_offset + song->info.data_size;
+    return (end < song->file.fsize) ? end : song->file.fsize;
+}
+
+static int link_map(song_t *song) {
+    // Build the cluster link map, from now on FatFS and the read ahead find
+    // every sector of the song without reading the FAT. A song with too many
+    // fragments for the map is read without read ahead.
+    song->map[0] = SONGS_PREFETCH_MAP_SIZE;
+    song->file.cltbl = song->map;
+    if (f_lseek(&song->file, CREATE_LINKMAP) != FR_OK) {
+        song->file.cltbl = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static prefetch_stream_t *stream_of(const song_t *song) {
+    for (int i = 0; i < 2; ++i) {
+        if (g_prefetch.streams[i].song == song) {
+            return &g_prefetch.streams[i];
+        }
+    }
+    return NULL;
+}
+
+static void prefetch_attach(prefetch_stream_t *stream, song_t *song, uint8_t started) {
+    // only while nothing is in flight, the stream is unused
+    size_t position = song->file.fptr;
+    if (g_carry.song == song) {
+        // read ahead what was carried too
+        position -= g_carry.length;
+        g_carry.song = NULL;
+        g_carry.length = 0;
+    }
+    stream->song = song;
+    stream->position = position;
+    stream->next = position - position % SECTOR_SIZE;
+    stream->started = started;
+}
+
+static void prefetch_detach(void) {
+    prefetch_stop();
+    prefetch_remove(&g_prefetch.streams[0]);
+    prefetch_remove(&g_prefetch.streams[1]);
+    g_prefetch.result = RES_OK;
+    g_prefetch.stopped = 0;
+}
+
+static void prefetch_unqueue(void) {
+    for (int i = 0; i < 2; ++i) {
+        prefetch_stream_t *stream = &g_prefetch.streams[i];
+        if (stream->song && !stream->started) {
+            prefetch_stop();
+            prefetch_remove(stream);
+            prefetch_resume();
+        }
+    }
+}
+
+static void prefetch_remove(prefetch_stream_t *stream) {
+    // only while stopped, nothing may be in flight
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        if (g_prefetch.blocks[i].stream == stream) {
+            g_prefetch.blocks[i].stream = NULL;
+        }
+    }
+    if (stream->song) {
+        // hand the stream position back to FatFS, it reads on with the map
+        f_lseek(&stream->song->file, stream->position);
+        stream->song = NULL;
+    }
+}
+
+static void prefetch_retire(prefetch_stream_t *stream) {
+    // A song that was read to its end makes room for the other one, if there
+    // is one. All of its blocks were requested and consumed, so the interrupt
+    // does not touch it anymore. Only from the main loop, the seek may read
+    // from the card.
+    prefetch_stream_t *other = &g_prefetch.streams[stream == &g_prefetch.streams[0]];
+    if (!other->song) {
+        return;
+    }
+    // Hand the position at the end back to FatFS like prefetch_remove(), or
+    // the next read of the song would go on from wherever FatFS was left.
+    song_t *song = stream->song;
+    stream->song = NULL;
+    f_lseek(&song->file, stream->position);
+}
+
+static void prefetch_restart(prefetch_stream_t *stream, size_t position) {
+    // Drop what was read ahead and read ahead from the new position on. Also
+    // called from the refill when a resampler takes over a song, so it does
+    // not wait for the block in flight. That one is left to the interrupt and
+    // dropped by songs_loop() if it is of no use anymore.
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        if (g_prefetch.blocks[i].stream == stream && g_prefetch.blocks[i].length) {
+            g_prefetch.blocks[i].stream = NULL;
+        }
+    }
+    stream->position = position;
+    stream->next = position - position % SECTOR_SIZE;
+    g_prefetch.result = RES_OK;
+}
+
+static void prefetch_stop(void) {
+    // start no further reads and let the last one end, the DMA must not write
+    // into the blocks anymore
+    g_prefetch.stopped = 1;
+    while (g_prefetch.pending) {
+    }
+}
+
+static void prefetch_resume(void) {
+    g_prefetch.stopped = 0;
+    prefetch_fill();
+}
+
+static void prefetch_tidy(void) {
+    // only while nothing is in flight
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        prefetch_block_t *block = &g_prefetch.blocks[i];
+        prefetch_stream_t *stream = block->stream;
+        if (!stream) {
+            continue;
+        }
+        size_t first = stream->position - stream->position % SECTOR_SIZE;
+        if (!block->length) {
+            // The read failed. Read it again, unless the stream was moved
+            // away from it.
+            if (first <= block->start && block->start < stream->next) {
+                stream->next = block->start;
+            }
+            block->stream = NULL;
+        } else if (block->start + block->length <= stream->position || block->start >= stream->next) {
+            // was in flight when the stream was moved
+            block->stream = NULL;
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        prefetch_stream_t *stream = &g_prefetch.streams[i];
+        if (stream->song && stream->started && stream->position >= data_end(stream->song)) {
+            prefetch_retire(stream);
+        }
+    }
+}
+
+static void prefetch_fill(void) {
+    // Only from the main loop, starting a read waits for the card. One block
+    // at a time, the next call starts the next one.
+    if (g_prefetch.stopped || g_prefetch.pending) {
+        return;
+    }
+    prefetch_tidy();
+    prefetch_stream_t *stream = prefetch_pick();
+    if (prefetch_start(stream) && stream && stream->started && !prefetch_resident(stream)) {
+        // No block is free, e.g. when the other song holds all of them. A song
+        // that ran dry takes the newest one of the other song.
+        if (!prefetch_steal(stream)) {
+            prefetch_start(stream);
+        }
+    }
+}
+
+static prefetch_block_t *prefetch_find(const prefetch_stream_t *stream, size_t position) {
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        prefetch_block_t *block = &g_prefetch.blocks[i];
+        if (block->stream == stream && block->start <= position && position < block->start + block->length) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t prefetch_resident(const prefetch_stream_t *stream) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        if (g_prefetch.blocks[i].stream == stream) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static uint32_t prefetch_quota(const prefetch_stream_t *stream) {
+    const prefetch_stream_t *other = &g_prefetch.streams[stream == &g_prefetch.streams[0]];
+    if (!other->song || other->next >= data_end(other->song)) {
+        // the other song needs no more blocks
+        return SONGS_PREFETCH_DEPTH;
+    }
+    if (!stream->started) {
+        // queued song, only to start with
+        return 1;
+    }
+    if (!other->started) {
+        return SONGS_PREFETCH_DEPTH - 1;
+    }
+    // both songs are read
+    return SONGS_PREFETCH_DEPTH / 2;
+}
+
+static prefetch_stream_t *prefetch_pick(void) {
+    // A stream that is about to run dry goes first. Otherwise the stream of
+    // the last read is read on, so that both are read in runs.
+    prefetch_stream_t *pick = NULL;
+    for (int i = 0; i < 2; ++i) {
+        prefetch_stream_t *stream = &g_prefetch.streams[i];
+        if (!stream->song || stream->next >= data_end(stream->song)) {
+            continue;
+        }
+        uint32_t resident = prefetch_resident(stream);
+        if (resident >= prefetch_quota(stream)) {
+            continue;
+        }
+        if (!resident && stream->started) {
+            return stream;
+        }
+        if (!pick || stream == g_prefetch.last) {
+            pick = stream;
+        }
+    }
+    return pick;
+}
+
+static int prefetch_steal(const prefetch_stream_t *stream) {
+    // only while nothing is in flight
+    prefetch_block_t *newest = NULL;
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        prefetch_block_t *block = &g_prefetch.blocks[i];
+        if (block->stream && block->stream != stream && (!newest || block->start > newest->start)) {
+            newest = block;
+        }
+    }
+    if (!newest) {
+        return -1;
+    }
+    // the other stream reads it again later
+    newest->stream->next = newest->start;
+    newest->stream = NULL;
+    return 0;
+}
+
+static int prefetch_start(prefetch_stream_t *stream) {
+    if (!stream || g_prefetch.stopped || stream->next >= data_end(stream->song)) {
+        // nothing more to read
+        return -1;
+    }
+    prefetch_block_t *block = NULL;
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        if (!g_prefetch.blocks[i].stream) {
+            block = &g_prefetch.blocks[i];
+            break;
+        }
+    }
+    if (!block) {
+        return -1;
+    }
+    // Read the next block of the file. Its cluster is looked up in the link
+    // map: the size of the map followed by pairs of fragment length and first
+    // cluster of the fragment, terminated by a zero length.
+    song_t *song = stream->song;
+    FATFS *fs = song->file.fs;
+    DWORD sector = stream->next / SECTOR_SIZE;
+    DWORD cluster = sector / fs->csize;
+    const DWORD *fragment = song->file.cltbl + 1;
+    while (fragment[0] && cluster >= fragment[0]) {
+        cluster -= fragment[0];
+        fragment += 2;
+    }
+    if (!fragment[0]) {
+        // beyond the end of the file
+        return -1;
+    }
+    // Read as many sectors as fit, but not beyond the end of the fragment (the
+    // next one is somewhere else on the card) or of the data.
+    UINT count = (fragment[0] - cluster) * fs->csize - sector % fs->csize;
+    DWORD left = (data_end(song) - stream->next + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (count > left) {
+        count = left;
+    }
+    if (count > SONGS_PREFETCH_BLOCK_SECTORS) {
+        count = SONGS_PREFETCH_BLOCK_SECTORS;
+    }
+    sector = (fragment[1] + cluster - 2) * fs->csize + fs->database + sector % fs->csize;
+    // The read may end before disk_read_async() returns, set up everything the
+    // interrupt needs beforehand.
+    block->start = stream->next;
+    block->end = block->start + count * SECTOR_SIZE;
+    if (block->end > data_end(song)) {
+        // the last sector of the data is only valid up to its end
+        block->end = data_end(song);
+    }
+    block->length = 0;
+    block->stream = stream;
+    stream->next += count * SECTOR_SIZE;
+    g_prefetch.last = stream;
+    g_prefetch.pending = 1;
+    g_prefetch.read_start = get_cycles();
+    if (disk_read_async(fs->drv, g_prefetch.data[block - g_prefetch.blocks], sector, count, prefetch_done, block) !=
+        RES_OK) {
+        stream->next = block->start;
+        block->stream = NULL;
+        g_prefetch.pending = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static void prefetch_done(DRESULT res, void *context) {
+    // Called from the interrupt that ended the read of a block. Touches only
+    // the block, the stream may have been moved by the refill in the meantime.
+    prefetch_block_t *block = context;
+    g_prefetch.read_cycles += get_cycles() - g_prefetch.read_start;
+    if (res == RES_OK) {
+        g_prefetch.read_bytes += block->end - block->start;
+        block->length = block->end - block->start;
+    } else {
+        // the block stays empty, songs_loop() reads it again
+        g_prefetch.result = res;
+    }
+    // The next block is started outside of the interrupt, starting a read
+    // waits for the card. Publish the block before the read is marked done.
+    __DMB();
+    g_prefetch.pending = 0;
+}
+
+int songs_loop(void) {
+    prefetch_fill();
+    return 0;
+}
+
+int songs_get_prefetch_stats(songs_prefetch_stats_t *stats) {
+    if (!stats) {
+        return -1;
+    }
+    stats->depth = SONGS_PREFETCH_DEPTH;
+    stats->fill = 0;
+    for (uint32_t i = 0; i < SONGS_PREFETCH_DEPTH; ++i) {
+        // blocks in flight don't count
+        if (g_prefetch.blocks[i].stream && g_prefetch.blocks[i].length) {
+            stats->fill++;
+        }
+    }
+    stats->hits = g_prefetch.hits;
+    stats->misses = g_prefetch.misses;
+    stats->throughput = 0;
+    if (g_prefetch.read_cycles) {
+        stats->throughput = g_prefetch.read_bytes * SystemCoreClock / g_prefetch.read_cycles;
+    }
+    // every song that is read needs 48000 stereo samples of 16 bit per second
+    uint32_t demand = 0;
+    for (int i = 0; i < 2; ++i) {
+        if (g_prefetch.streams[i].song && g_prefetch.streams[i].started) {
+            demand += 2 * 2 * 48000;
+        }
+    }
+    stats->headroom = demand ? (uint64_t)stats->throughput * 100 / demand : 0;
     return 0;
 }
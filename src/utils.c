@@ -18,6 +18,10 @@ void utils_init() {
     RCC_ClocksTypeDef clocks;
     RCC_GetClocksFreq(&clocks);
     SysTick_Config(clocks.HCLK_Frequency / 1000 - 1);
+    // enable the cycle counter of the data watchpoint and trace unit
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
 static __IO uint32_t system_ticks;
@@ -38,6 +42,10 @@ uint32_t get_ticks() {
     return system_ticks;
 }
 
+uint32_t get_cycles() {
+    return DWT->CYCCNT;
+}
+
 static struct {
     uint32_t start;
     uint32_t last_enter;
@@ -0,0 +1,101 @@
+/**
+ * @file ramdisk.c
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Disk of FatFS in RAM for host tests.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ *
+ * Also provides what the modules under test take from utils.c and the startup
+ * code of the target.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "diskio.h"
+#include "ramdisk.h"
+
+#define SECTOR_SIZE (512U)
+
+uint32_t SystemCoreClock = 1000000000U; // get_cycles() counts nanoseconds
+
+uint32_t ramdisk_reads;
+uint32_t ramdisk_sectors;
+
+static uint8_t g_image[RAMDISK_SECTORS][SECTOR_SIZE];
+
+DSTATUS disk_initialize(BYTE drv) {
+    return drv ? STA_NOINIT : 0;
+}
+
+DSTATUS disk_status(BYTE drv) {
+    return drv ? STA_NOINIT : 0;
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, UINT count) {
+    if (drv || sector + count > RAMDISK_SECTORS) {
+        return RES_PARERR;
+    }
+    ramdisk_reads++;
+    ramdisk_sectors += count;
+    memcpy(buff, g_image[sector], count * SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_read_async(BYTE drv, BYTE *buff, DWORD sector, UINT count, disk_callback callback, void *context) {
+    if (!callback || ((uintptr_t)buff & 3)) {
+        return RES_PARERR;
+    }
+    DRESULT res = disk_read(drv, buff, sector, count);
+    if (res == RES_OK) {
+        callback(res, context);
+    }
+    return res;
+}
+
+int disk_busy(BYTE drv) {
+    (void)drv;
+    return 0;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count) {
+    if (drv || sector + count > RAMDISK_SECTORS) {
+        return RES_PARERR;
+    }
+    memcpy(g_image[sector], buff, count * SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE cmd, void *buff) {
+    if (drv) {
+        return RES_PARERR;
+    }
+    switch (cmd) {
+    case (CTRL_SYNC):
+        return RES_OK;
+    case (GET_SECTOR_COUNT):
+        *(DWORD *)buff = RAMDISK_SECTORS;
+        return RES_OK;
+    case (GET_SECTOR_SIZE):
+        *(WORD *)buff = SECTOR_SIZE;
+        return RES_OK;
+    case (GET_BLOCK_SIZE):
+        *(DWORD *)buff = 1;
+        return RES_OK;
+    default:
+        return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void) {
+    // 2026-01-01 00:00:00
+    return ((DWORD)(2026 - 1980) << 25) | (1U << 21) | (1U << 16);
+}
+
+uint32_t get_cycles(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
@@ -0,0 +1,22 @@
+/**
+ * @file ramdisk.h
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Disk of FatFS in RAM for host tests.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ *
+ * Implements diskio.h on an image in RAM and counts the reads, so a test can
+ * tell how many times a module went to the card. Asynchronous reads complete
+ * right away, before disk_read_async() returns.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define RAMDISK_SECTORS (8192U) //!< size of the image, 4 MiB
+
+extern uint32_t ramdisk_reads;   //!< count of reads, synchronous and asynchronous
+extern uint32_t ramdisk_sectors; //!< count of sectors they read
@@ -0,0 +1,20 @@
+/**
+ * @file stm32f4xx.h
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Stand in for the device header of the target in host tests.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ *
+ * Only what the modules under test use of the device header and of CMSIS.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __DMB() __sync_synchronize()
+
+extern uint32_t SystemCoreClock;
@@ -0,0 +1,182 @@
+/**
+ * @file test_dft.c
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Host test of the dft backends against a reference dft.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ *
+ * Feeds blocks of tones and noise through dft_transform() of the backend that
+ * was selected with DFT_BACKEND on the command line. The same blocks are
+ * decimated by a decimator of its own and transformed by a direct form dft in
+ * double precision, with the window of DFT_WINDOW. Every magnitude has to be
+ * within a tolerance of the reference, relative to the strongest bin. Then the
+ * band levels of steady sines are checked against their level in dB.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decimator.h"
+#include "dft.h"
+
+#define BLOCKS (40)
+#define PI (3.14159265358979323846)
+
+#if (DFT_BACKEND == DFT_BACKEND_Q15)
+#define TOLERANCE (2e-3) // the samples are windowed and rounded in Q15
+#elif (DFT_BACKEND == DFT_BACKEND_SLIDING)
+#define TOLERANCE (2e-2) // older samples are damped by up to DFT_SLIDING_DAMPING^DFT_N
+#else
+#define TOLERANCE (1e-4)
+#endif
+
+static decimator_t g_reference[DFT_CHANNELS_NUM];
+static int16_t g_history[DFT_CHANNELS_NUM][DFT_N]; // last DFT_N decimated samples
+
+// coefficients of the cosine sum window of DFT_WINDOW
+#if (DFT_WINDOW == DFT_WINDOW_RECTANGULAR)
+static const double g_window_terms[5] = {1.0, 0.0, 0.0, 0.0, 0.0};
+#elif (DFT_WINDOW == DFT_WINDOW_HANN)
+static const double g_window_terms[5] = {0.5, 0.5, 0.0, 0.0, 0.0};
+#elif (DFT_WINDOW == DFT_WINDOW_BLACKMAN_HARRIS)
+static const double g_window_terms[5] = {0.35875, 0.48829, 0.14128, 0.01168, 0.0};
+#elif (DFT_WINDOW == DFT_WINDOW_FLAT_TOP)
+static const double g_window_terms[5] = {0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368};
+#endif
+
+/**
+ * @brief Window of DFT_WINDOW in double precision.
+ *
+ * @param n index of the sample
+ * @return weight of the sample
+ */
+static double window(int n) {
+    double w = 0.0;
+    for (int i = 0; i < 5; ++i) {
+        w += ((i % 2) ? -g_window_terms[i] : g_window_terms[i]) * cos(i * 2 * PI * n / DFT_N);
+    }
+    return w;
+}
+
+/**
+ * @brief Power of every bin of the last DFT_N decimated samples.
+ *
+ * Normalized like the magnitudes of dft.h, by the length and the gain of the
+ * window.
+ *
+ * @param[in] samples DFT_N samples
+ * @param[out] power DFT_MAGNITUDE_SIZE powers
+ */
+static void reference_dft(const int16_t *samples, double *power) {
+    for (int k = 0; k < DFT_MAGNITUDE_SIZE; ++k) {
+        double re = 0.0;
+        double im = 0.0;
+        for (int n = 0; n < DFT_N; ++n) {
+            double s = samples[n] * window(n);
+            re += s * cos(2 * PI * k * n / DFT_N);
+            im -= s * sin(2 * PI * k * n / DFT_N);
+        }
+        double gain = DFT_N * g_window_terms[0];
+        power[k] = (re * re + im * im) / (gain * gain);
+    }
+}
+
+/**
+ * @brief Check the band levels of a steady sine.
+ *
+ * The sine is fed long enough to fill the whole window. The window spreads
+ * its power over a few bins, the loudest band has to be within 1 dB of the
+ * level of the sine.
+ *
+ * @param dbfs level of the sine relative to full scale
+ * @return count of failed checks
+ */
+static int check_bands(double dbfs) {
+    static int16_t block[DFT_SAMPLE_SIZE];
+    static uint32_t magnitude[DFT_CHANNELS_NUM * DFT_MAGNITUDE_SIZE];
+    uint32_t bands[DFT_BANDS_NUM];
+    double amplitude = (dbfs > -200.0) ? 32767 * pow(10.0, dbfs / 20) : 0.0;
+    for (int b = 0; b < 4; ++b) {
+        for (int i = 0; i < DFT_SAMPLE_SIZE / 2; ++i) {
+            int t = b * DFT_SAMPLE_SIZE / 2 + i;
+            block[2 * i] = block[2 * i + 1] = (int16_t)lround(amplitude * sin(2 * PI * 1000.0 * t / 48000));
+        }
+        dft_transform(block, magnitude);
+    }
+    dft_map_bands(magnitude, bands);
+    uint32_t loudest = 0;
+    for (int b = 0; b < DFT_BANDS_NUM; ++b) {
+        loudest = (bands[b] > loudest) ? bands[b] : loudest;
+    }
+    // in steps of 0.1 dB above the bottom of the range
+    double expected = 10 * (dbfs + DFT_BANDS_RANGE_DB);
+    expected = (expected < 0) ? 0 : (expected > DFT_BANDS_FULL_SCALE) ? DFT_BANDS_FULL_SCALE : expected;
+    int fail = fabs(loudest - expected) > 10;
+    printf("sine at %.0f dBFS: loudest band %lu of %u, expected %.0f%s\n", dbfs, (unsigned long)loudest,
+           DFT_BANDS_FULL_SCALE, expected, fail ? " FAIL" : "");
+    return fail;
+}
+
+int main(void) {
+    static int16_t block[DFT_SAMPLE_SIZE];
+    static int16_t decimated[DECIMATOR_OUTPUT_SIZE];
+    static uint32_t magnitude[DFT_CHANNELS_NUM * DFT_MAGNITUDE_SIZE];
+    static double power[DFT_MAGNITUDE_SIZE];
+    dft_init();
+#if (DFT_CHANNELS_NUM == 2)
+    decimator_init(&g_reference[0], DFT_CHANNEL_LEFT);
+    decimator_init(&g_reference[1], DFT_CHANNEL_RIGHT);
+#else
+    decimator_init(&g_reference[0], DFT_SAMPLE_CHANNEL);
+#endif
+    srand(1);
+    int fails = 0;
+    double worst = 0.0;
+    for (int b = 0; b < BLOCKS; ++b) {
+        // A tone that sweeps through the spectrum, a fixed tone on the right
+        // channel only and some noise. Quiet in the first blocks, loud later.
+        double level = (b < BLOCKS / 2) ? 0.05 : 0.9;
+        for (int i = 0; i < DFT_SAMPLE_SIZE / 2; ++i) {
+            int t = b * DFT_SAMPLE_SIZE / 2 + i;
+            double sweep = sin(2 * PI * (200.0 + 50.0 * b) * t / 48000);
+            double tone = sin(2 * PI * 1000.0 * t / 48000);
+            double noise = (rand() % 2001 - 1000) / 1000.0;
+            block[2 * i] = (int16_t)(32767 * level * (0.7 * sweep + 0.05 * noise));
+            block[2 * i + 1] = (int16_t)(32767 * level * (0.4 * sweep + 0.4 * tone + 0.05 * noise));
+        }
+        dft_transform(block, magnitude);
+        for (int c = 0; c < DFT_CHANNELS_NUM; ++c) {
+            decimator_process(&g_reference[c], block, decimated);
+            memmove(g_history[c], g_history[c] + DECIMATOR_OUTPUT_SIZE,
+                    (DFT_N - DECIMATOR_OUTPUT_SIZE) * sizeof(int16_t));
+            memcpy(g_history[c] + DFT_N - DECIMATOR_OUTPUT_SIZE, decimated, DECIMATOR_OUTPUT_SIZE * sizeof(int16_t));
+            reference_dft(g_history[c], power);
+            double peak = 1.0;
+            for (int k = 0; k < DFT_MAGNITUDE_SIZE; ++k) {
+                peak = (power[k] > peak) ? power[k] : peak;
+            }
+            for (int k = 0; k < DFT_MAGNITUDE_SIZE; ++k) {
+                // the magnitudes are truncated and clamped to the range of uint32_t
+                double expected = (power[k] < UINT32_MAX) ? power[k] : UINT32_MAX;
+                double error = fabs(magnitude[c * DFT_MAGNITUDE_SIZE + k] - expected);
+                error = (error > 1.0) ? (error - 1.0) / peak : 0.0;
+                worst = (error > worst) ? error : worst;
+                if (error > TOLERANCE && fails++ < 10) {
+                    printf("block %d channel %d bin %d: %lu, expected %.0f\n", b, c, k,
+                           (unsigned long)magnitude[c * DFT_MAGNITUDE_SIZE + k], expected);
+                }
+            }
+        }
+    }
+    fails += check_bands(0.0);
+    fails += check_bands(-20.0);
+    fails += check_bands(-40.0);
+    fails += check_bands(-300.0);
+    printf("dft backend %u, %u channel(s): max error %.2e of the peak, fails=%d\n", DFT_BACKEND, DFT_CHANNELS_NUM,
+           worst, fails);
+    return fails != 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file test_mixer.c
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Host test of the crossfade of the mixer.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ *
+ * Checks the gains of mixer_crossfade() at the start, the middle and the end
+ * of a crossfade and that both powers sum up to one all along. Full scale
+ * songs have to saturate instead of wrap around, on their own with
+ * __QADD16() of simd.h and in the mix. A crossfade mixed in blocks has to
+ * give the same samples as one mixed at once.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mixer.h"
+#include "simd.h"
+
+#define DURATION (2U * 48000U) // 1 s of stereo samples
+#define BLOCK (1920U)          // samples per refill of the player
+
+/**
+ * @brief Gains of both songs at a position of the crossfade.
+ *
+ * Mixes a single stereo pair, once with only the outgoing song and once with
+ * only the incoming one at half scale.
+ *
+ * @param position samples of the crossfade that were mixed before
+ * @param[out] fade_out gain of the outgoing song
+ * @param[out] fade_in gain of the incoming song
+ */
+static void measure_gains(uint32_t position, double *fade_out, double *fade_in) {
+    static int16_t signal[2] __attribute__((aligned(4))) = {16384, -16384};
+    static int16_t silence[2] __attribute__((aligned(4)));
+    static int16_t mixed[2] __attribute__((aligned(4)));
+    mixer_crossfade(signal, silence, mixed, 2, position, DURATION);
+    *fade_out = mixed[0] / 16384.0;
+    mixer_crossfade(silence, signal, mixed, 2, position, DURATION);
+    *fade_in = mixed[0] / 16384.0;
+}
+
+/**
+ * @brief Check the gains at one position of the crossfade.
+ *
+ * @param name what is checked
+ * @param position samples of the crossfade that were mixed before
+ * @param fade_out expected gain of the outgoing song
+ * @param fade_in expected gain of the incoming song
+ * @return count of failed checks
+ */
+static int check_gains(const char *name, uint32_t position, double fade_out, double fade_in) {
+    double out, in;
+    measure_gains(position, &out, &in);
+    // half scale samples, the gains are exact to one lsb
+    int fail = fabs(out - fade_out) > 1.0 / 16384 || fabs(in - fade_in) > 1.0 / 16384;
+    printf("gains at %s: %.4f out, %.4f in, expected %.4f and %.4f%s\n", name, out, in, fade_out, fade_in,
+           fail ? " FAIL" : "");
+    return fail;
+}
+
+/**
+ * @brief Check the sum of both powers over the whole crossfade.
+ *
+ * @return count of failed checks
+ */
+static int check_power(void) {
+    double worst = 0.0;
+    for (uint32_t position = 0; position <= DURATION; position += 2) {
+        double out, in;
+        measure_gains(position, &out, &in);
+        double error = fabs(out * out + in * in - 1.0);
+        worst = (error > worst) ? error : worst;
+    }
+    int fail = worst > 1e-3;
+    printf("power over the crossfade: max deviation %.2e from one%s\n", worst, fail ? " FAIL" : "");
+    return fail;
+}
+
+/**
+ * @brief Check the saturation of __QADD16() and of the mix.
+ *
+ * @return count of failed checks
+ */
+static int check_saturation(void) {
+    static const struct {
+        uint32_t op1, op2, sum;
+    } cases[] = {
+        {0x7FFF7FFFU, 0x00010001U, 0x7FFF7FFFU}, // both halfwords clip at the top
+        {0x80008000U, 0xFFFFFFFFU, 0x80008000U}, // both at the bottom
+        {0x00017FFFU, 0x00020001U, 0x00037FFFU}, // only the low one clips
+        {0x7FFF0001U, 0x7FFFFFFEU, 0x7FFFFFFFU}, // only the high one, the low one turns negative
+        {0x12345678U, 0xEDCBA988U, 0xFFFF0000U}, // no carry from low to high
+    };
+    int fails = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        uint32_t sum = __QADD16(cases[i].op1, cases[i].op2);
+        if (sum != cases[i].sum) {
+            printf("__QADD16(0x%08lX, 0x%08lX) = 0x%08lX, expected 0x%08lX FAIL\n", (unsigned long)cases[i].op1,
+                   (unsigned long)cases[i].op2, (unsigned long)sum, (unsigned long)cases[i].sum);
+            fails++;
+        }
+    }
+    // In the middle each song is scaled by 0.707, two full scale songs in
+    // phase add up to 1.41 of full scale.
+    static int16_t loud[4] __attribute__((aligned(4))) = {32767, -32768, 30000, -30000};
+    static int16_t mixed[4] __attribute__((aligned(4)));
+    mixer_crossfade(loud, loud, mixed, 4, DURATION / 2, DURATION);
+    if (mixed[0] != INT16_MAX || mixed[1] != INT16_MIN || mixed[2] != INT16_MAX || mixed[3] != INT16_MIN) {
+        printf("mix of full scale songs: %d %d %d %d, expected %d %d %d %d FAIL\n", mixed[0], mixed[1], mixed[2],
+               mixed[3], INT16_MAX, INT16_MIN, INT16_MAX, INT16_MIN);
+        fails++;
+    }
+    printf("saturation: %d fails\n", fails);
+    return fails;
+}
+
+/**
+ * @brief Check that a crossfade mixed in blocks is the same as one at once.
+ *
+ * Mixes into one of the inputs, like the player does.
+ *
+ * @return count of failed checks
+ */
+static int check_blocks(void) {
+    static int16_t outgoing[DURATION + BLOCK] __attribute__((aligned(4)));
+    static int16_t incoming[DURATION + BLOCK] __attribute__((aligned(4)));
+    static int16_t whole[DURATION + BLOCK] __attribute__((aligned(4)));
+    srand(1);
+    for (size_t n = 0; n < DURATION + BLOCK; ++n) {
+        outgoing[n] = (int16_t)(rand() % 65536 - 32768);
+        incoming[n] = (int16_t)(rand() % 65536 - 32768);
+    }
+    mixer_crossfade(outgoing, incoming, whole, DURATION + BLOCK, 0, DURATION);
+    for (size_t n = 0; n < DURATION + BLOCK; n += BLOCK) {
+        mixer_crossfade(outgoing + n, incoming + n, outgoing + n, BLOCK, n, DURATION);
+    }
+    int fails = 0;
+    for (size_t n = 0; n < DURATION + BLOCK; ++n) {
+        if (outgoing[n] != whole[n] && fails++ < 10) {
+            printf("sample %zu: %d in blocks, %d at once FAIL\n", n, outgoing[n], whole[n]);
+        }
+    }
+    // past the end only the incoming song is left
+    for (size_t n = DURATION; n < DURATION + BLOCK; ++n) {
+        if (whole[n] != incoming[n] && fails++ < 10) {
+            printf("sample %zu after the crossfade: %d, expected %d FAIL\n", n, whole[n], incoming[n]);
+        }
+    }
+    printf("crossfade in blocks of %u: %d fails\n", BLOCK, fails);
+    return fails;
+}
+
+int main(void) {
+    int fails = 0;
+    fails += check_gains("the start", 0, 1.0, 0.0);
+    fails += check_gains("the middle", DURATION / 2, sqrt(0.5), sqrt(0.5));
+    fails += check_gains("the end", DURATION, 0.0, 1.0);
+    fails += check_power();
+    fails += check_saturation();
+    fails += check_blocks();
+    printf("mixer: fails=%d\n", fails);
+    return fails != 0;
+}
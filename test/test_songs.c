@@ -0,0 +1,435 @@
+/**
+ * @file test_songs.c
+ * @author Leuenberger Niklaus <leuen4@bfh.ch>
+ * @brief Host test and benchmark of the wav header parser of the songs module.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026 Niklaus Leuenberger
+ *
+ * Writes wav files to a FatFS volume in RAM and opens them with
+ * songs_open_song(). The corpus is synthetic: the test builds each header byte
+ * by byte after the layout that a common tool writes, e.g. sox, ffmpeg,
+ * Audacity and broadcast wave files, and hostile ones with sizes that don't
+ * fit. No file written by one of these tools is checked in, so a chunk that a
+ * real encoder writes but the corpus lacks is not covered. Every file has to
+ * open or fail as expected, with the info of its LIST chunk, and play the
+ * right pcm data. Headers that fit in the first sector must not take more
+ * reads of the disk than the plain 44 byte header.
+ * Then every truncation and random mutations of a header must neither crash
+ * nor open with info that does not fit the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ramdisk.h"
+#include "songs.h"
+#include "utils.h"
+
+#define FILE_NAME "X.WAV"
+#define PCM_VALUE (0x1234)
+#define MUTATIONS (3000)
+
+/**
+ * @brief File that is built up in RAM before it is written to the volume.
+ *
+ */
+static struct {
+    uint8_t data[16384];
+    size_t length;
+} g_file;
+
+static song_t g_song;
+
+static void put(const void *data, size_t length) {
+    memcpy(g_file.data + g_file.length, data, length);
+    g_file.length += length;
+}
+
+static void put_u16(uint16_t value) {
+    put(&value, sizeof(value));
+}
+
+static void put_u32(uint32_t value) {
+    put(&value, sizeof(value));
+}
+
+static void put_chunk(const char *id, uint32_t size) {
+    put(id, 4);
+    put_u32(size);
+}
+
+/**
+ * @brief Chunk with a string, padded to an even length.
+ *
+ * @param id id of the chunk
+ * @param text string, its terminating zero is part of the chunk
+ */
+static void put_string(const char *id, const char *text) {
+    uint32_t size = strlen(text) + 1;
+    put_chunk(id, size);
+    put(text, size);
+    if (size % 2) {
+        g_file.data[g_file.length++] = 0;
+    }
+}
+
+/**
+ * @brief Chunk of any size, filled with zeros and padded to an even length.
+ *
+ * @param id id of the chunk
+ * @param size size of the chunk
+ */
+static void put_filler(const char *id, uint32_t size) {
+    put_chunk(id, size);
+    memset(g_file.data + g_file.length, 0, size + size % 2);
+    g_file.length += size + size % 2;
+}
+
+/**
+ * @brief Start of every file, the RIFF and the fmt chunk.
+ *
+ * @param rate sample rate of the pcm data
+ */
+static void put_riff(uint32_t rate) {
+    g_file.length = 0;
+    put_chunk("RIFF", 0);
+    put("WAVE", 4);
+    put_chunk("fmt ", 16);
+    put_u16(1); // pcm
+    put_u16(2);
+    put_u32(rate);
+    put_u32(rate * 4);
+    put_u16(4);
+    put_u16(16);
+}
+
+/**
+ * @brief Start a chunk of id "LIST" with the format "INFO".
+ *
+ * @return offset of the chunk, to be passed to end_list()
+ */
+static size_t begin_list(void) {
+    size_t offset = g_file.length;
+    put_chunk("LIST", 0);
+    put("INFO", 4);
+    return offset;
+}
+
+static void end_list(size_t offset) {
+    uint32_t size = g_file.length - offset - 8;
+    memcpy(g_file.data + offset + 4, &size, sizeof(size));
+}
+
+/**
+ * @brief Chunk of id "data" with pcm data.
+ *
+ * @param size size the chunk claims
+ * @param bytes pcm data that follows, less than size for a cut off file
+ */
+static void put_data(uint32_t size, size_t bytes) {
+    put_chunk("data", size);
+    for (size_t i = 0; i < bytes / 2; ++i) {
+        put_u16(PCM_VALUE);
+    }
+}
+
+/**
+ * @brief End of every file, the size of the RIFF chunk.
+ *
+ */
+static void finish(void) {
+    uint32_t size = g_file.length - 8;
+    memcpy(g_file.data + 4, &size, sizeof(size));
+}
+
+static void write_file(size_t length) {
+    FIL file;
+    UINT written;
+    f_open(&file, FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE);
+    f_write(&file, g_file.data, length, &written);
+    f_close(&file);
+}
+
+// sox, and ffmpeg with -bitexact: nothing but fmt and data
+static void corpus_plain(void) {
+    put_riff(48000);
+    put_data(4000, 4000);
+}
+
+// ffmpeg: LIST with the software that wrote it
+static void corpus_ffmpeg(void) {
+    put_riff(48000);
+    size_t list = begin_list();
+    put_string("ISFT", "Lavf58.76.100");
+    end_list(list);
+    put_data(4000, 4000);
+}
+
+// Audacity and most taggers: LIST with title, artist and more
+static void corpus_tagged(void) {
+    put_riff(48000);
+    size_t list = begin_list();
+    put_string("IART", "Artist");
+    put_string("INAM", "Title");
+    put_string("IPRD", "Album");
+    put_string("ICRD", "2021");
+    put_string("ISFT", "Lavf58.76.100");
+    end_list(list);
+    put_data(4000, 4000);
+}
+
+// odd length strings and a title that does not fit into song_info_t
+static void corpus_long(void) {
+    put_riff(48000);
+    size_t list = begin_list();
+    put_string("INAM", "0123456789012345678901234567890123456789");
+    put_string("IART", "Odd");
+    end_list(list);
+    put_data(4000, 4000);
+}
+
+// a LIST of another format, e.g. labels and notes
+static void corpus_adtl(void) {
+    put_riff(48000);
+    put_chunk("LIST", 4);
+    put("adtl", 4);
+    put_data(4000, 4000);
+}
+
+// Pro Tools and some editors: reserve space with JUNK for a later header
+static void corpus_junk(void) {
+    put_riff(48000);
+    put_filler("JUNK", 28);
+    put_data(4000, 4000);
+}
+
+// broadcast wave with a cue sheet, LIST behind more than a sector of chunks
+static void corpus_far(void) {
+    put_riff(48000);
+    put_filler("bext", 602);
+    put_filler("cue ", 400);
+    size_t list = begin_list();
+    put_string("INAM", "Far");
+    put_string("IART", "Away");
+    end_list(list);
+    put_data(4000, 4000);
+}
+
+// data that claims more than the file holds, e.g. a cut off recording
+static void corpus_cut(void) {
+    put_riff(48000);
+    put_data(0xFFFFFFFFU, 4000);
+}
+
+// a sub chunk of the LIST that claims more than the LIST holds, the song is
+// still valid but has no info
+static void corpus_bad_list(void) {
+    put_riff(48000);
+    put_chunk("LIST", 16);
+    put("INFO", 4);
+    put_chunk("INAM", 0xFFFFFFF0U);
+    put_u32(0);
+    put_data(4000, 4000);
+}
+
+// a chunk that claims more than the file holds
+static void corpus_huge(void) {
+    put_riff(48000);
+    put_chunk("JUNK", 0xFFFFFFF8U);
+    put_data(4000, 4000);
+}
+
+// WAVE_FORMAT_EXTENSIBLE is not supported
+static void corpus_extensible(void) {
+    g_file.length = 0;
+    put_chunk("RIFF", 0);
+    put("WAVE", 4);
+    put_chunk("fmt ", 40);
+    put_u16(0xFFFE);
+    put_u16(2);
+    put_u32(48000);
+    put_u32(192000);
+    put_u16(4);
+    put_u16(16);
+    // extension with the channel mask and the sub format
+    memset(g_file.data + g_file.length, 0, 24);
+    g_file.length += 24;
+    put_data(4000, 4000);
+}
+
+// mono is not supported
+static void corpus_mono(void) {
+    put_riff(48000);
+    g_file.data[22] = 1;
+    put_data(4000, 4000);
+}
+
+static void corpus_no_data(void) {
+    put_riff(48000);
+    put_filler("JUNK", 3);
+}
+
+static void corpus_empty_data(void) {
+    put_riff(48000);
+    put_data(0, 0);
+}
+
+/**
+ * @brief Header of the corpus and what opening it has to give.
+ *
+ */
+typedef struct {
+    const char *what;
+    void (*build)(void);
+    int valid;          // opens
+    const char *name;   // title, NULL for the name of the file
+    const char *artist; // NULL if there is no info
+    int first_sector;   // headers up to the pcm data fit into the first sector
+} corpus_entry_t;
+
+static const corpus_entry_t g_corpus[] = {
+    {"plain", corpus_plain, 1, NULL, NULL, 1},
+    {"ffmpeg", corpus_ffmpeg, 1, NULL, NULL, 1},
+    {"tagged", corpus_tagged, 1, "Title", "Artist", 1},
+    {"long", corpus_long, 1, "0123456789012345678901234567890123456789", "Odd", 1},
+    {"adtl", corpus_adtl, 1, NULL, NULL, 1},
+    {"junk", corpus_junk, 1, NULL, NULL, 1},
+    {"far", corpus_far, 1, "Far", "Away", 0},
+    {"cut", corpus_cut, 1, NULL, NULL, 1},
+    {"bad list", corpus_bad_list, 1, NULL, NULL, 1},
+    {"huge", corpus_huge, 0, NULL, NULL, 1},
+    {"extensible", corpus_extensible, 0, NULL, NULL, 1},
+    {"mono", corpus_mono, 0, NULL, NULL, 1},
+    {"no data", corpus_no_data, 0, NULL, NULL, 1},
+    {"empty data", corpus_empty_data, 0, NULL, NULL, 1},
+};
+
+/**
+ * @brief Compare a string of the song info with the expected one.
+ *
+ * The info is cut off to fit SONGS_MAX_STRING_LENGTH.
+ *
+ * @param expected expected string
+ * @param actual string of the song info
+ * @return 1 if they match, 0 otherwise
+ */
+static int same_string(const char *expected, const char *actual) {
+    return !strncmp(expected, actual, SONGS_MAX_STRING_LENGTH - 1) && strlen(actual) < SONGS_MAX_STRING_LENGTH;
+}
+
+/**
+ * @brief Open the file of a corpus entry and check it.
+ *
+ * @param entry corpus entry, its file was written
+ * @param[out] reads reads of the disk that opening took
+ * @return count of failed checks
+ */
+static int check_entry(const corpus_entry_t *entry, uint32_t *reads) {
+    ramdisk_reads = 0;
+    int ret = songs_open_song(FILE_NAME, &g_song);
+    *reads = ramdisk_reads;
+    int fails = 0;
+    if ((ret == 0) != entry->valid) {
+        printf("%s: open returned %d\n", entry->what, ret);
+        fails++;
+    } else if (!ret) {
+        const char *name = entry->name ? entry->name : "X";
+        const char *artist = entry->artist ? entry->artist : "Unknown";
+        if (!same_string(name, g_song.info.name) || !same_string(artist, g_song.info.artist)) {
+            printf("%s: info '%s' '%s'\n", entry->what, g_song.info.name, g_song.info.artist);
+            fails++;
+        }
+        int16_t pcm[64];
+        size_t length = 64;
+        if (songs_read_song(&g_song, pcm, &length) || length != 64 || pcm[0] != PCM_VALUE || pcm[63] != PCM_VALUE) {
+            printf("%s: pcm data not found\n", entry->what);
+            fails++;
+        }
+    }
+    songs_close_song(&g_song);
+    return fails;
+}
+
+/**
+ * @brief Open truncations and mutations of a tagged header.
+ *
+ * Each must either fail or give info that fits, the pcm data within the file.
+ *
+ * @return count of failed checks
+ */
+static int check_mutations(void) {
+    corpus_tagged();
+    size_t length = g_file.length;
+    static uint8_t original[sizeof(g_file.data)];
+    memcpy(original, g_file.data, length);
+    size_t data_offset = length - 4000;
+    int fails = 0;
+    for (size_t cut = 0; cut < data_offset; ++cut) {
+        write_file(cut);
+        if (!songs_open_song(FILE_NAME, &g_song)) {
+            printf("cut at %zu: opened\n", cut);
+            fails++;
+        }
+        songs_close_song(&g_song);
+    }
+    srand(1);
+    int opened = 0;
+    for (int i = 0; i < MUTATIONS; ++i) {
+        memcpy(g_file.data, original, length);
+        for (int m = 1 + rand() % 4; m > 0; --m) {
+            g_file.data[12 + rand() % (data_offset - 12)] = rand();
+        }
+        write_file(length);
+        if (songs_open_song(FILE_NAME, &g_song)) {
+            songs_close_song(&g_song);
+            continue;
+        }
+        opened++;
+        if (g_song.info.data_offset > length || strlen(g_song.info.name) >= SONGS_MAX_STRING_LENGTH ||
+            strlen(g_song.info.artist) >= SONGS_MAX_STRING_LENGTH) {
+            printf("mutation %d: info does not fit the file\n", i);
+            fails++;
+        }
+        int16_t pcm[64];
+        size_t samples = 64;
+        songs_read_song(&g_song, pcm, &samples);
+        songs_close_song(&g_song);
+    }
+    printf("%d of %d mutated headers opened\n", opened, MUTATIONS);
+    return fails;
+}
+
+int main(void) {
+    static FATFS fs;
+    if (f_mount(&fs, "0:", 0) != FR_OK || f_mkfs("0:", 1, 2048) != FR_OK || songs_init()) {
+        puts("no volume");
+        return 1;
+    }
+    int fails = 0;
+    uint32_t plain_reads = 0;
+    for (size_t i = 0; i < sizeof(g_corpus) / sizeof(g_corpus[0]); ++i) {
+        const corpus_entry_t *entry = &g_corpus[i];
+        entry->build();
+        finish();
+        write_file(g_file.length);
+        uint32_t reads;
+        // the first open finds the file in the directory, measure the second
+        fails += check_entry(entry, &reads);
+        uint32_t start = get_cycles();
+        fails += check_entry(entry, &reads);
+        uint32_t cycles = get_cycles() - start;
+        if (i == 0) {
+            plain_reads = reads;
+        }
+        int slow = entry->valid && entry->first_sector && reads > plain_reads;
+        fails += slow;
+        printf("%-10s %5zu bytes: %2lu reads, %6lu cycles%s\n", entry->what, g_file.length, (unsigned long)reads,
+               (unsigned long)cycles, slow ? " FAIL" : "");
+    }
+    fails += check_mutations();
+    printf("fails=%d\n", fails);
+    return fails != 0;
+}